@@ -0,0 +1,228 @@
+#!/bin/sh
+#
+# Script for comparing MPICH CH4 critical-section variants: builds them with
+# installMPICH.sh, builds perftest-1.5 against each and runs one benchmark
+# matrix on the local machine
+##
+
+# shellcheck disable=SC2039
+
+################################
+## Constants
+################################
+
+LOG_PREFIX="[BenchMPICH]:"
+
+SCRIPT_DIR=$(cd "$(dirname "$0")" && pwd)
+COMPILED_DIR="$SCRIPT_DIR/mpich/compiled"
+BENCH_DIR="$SCRIPT_DIR/bench"
+PERFTEST_SRC="$SCRIPT_DIR/perftest-1.5"
+
+HELP="
+Usage: sh benchMPICH.sh [Options]
+
+Options:
+	-V [variants] - comma separated list of global, trylock, handoff, hybrid
+	              default is global,trylock,handoff
+	-n [np] - number of processes, default 2
+	-T [threads] - threads per process of the mt message rate, default 4
+	-B - do not build MPICH, use the installations already in $COMPILED_DIR
+	-O [installMPICH.sh options] - extra options for every MPICH build, e.g. \"-o -b 3.3.x\"
+	-o [file] - also write the table to this file
+	-q - quick runs (mpptest -quick), for smoke testing
+	-h - show this message
+
+Every variant is benchmarked with MPI_THREAD_SINGLE (st) and MPI_THREAD_MULTIPLE (mt).
+Only the mt msgrate row runs concurrent threads; the other mt rows are
+single-threaded and show the cost of the MPI_THREAD_MULTIPLE level alone:
+	pingpong   mpptest, 8 byte blocking pingpong        -> latency
+	msgrate    mpptest -window 64, 8 byte stream, in mt
+	           one stream per thread (-threads)          -> time per message, message rate
+	bandwidth  mpptest, 1 MiB blocking pingpong          -> latency, bandwidth
+	halo       mpptest -halo, 1 KiB to every neighbour   -> latency, bandwidth
+	allreduce  goptest -dsum, 1 double (st only)         -> latency
+followed by a short stress run (st only) as a sanity check.
+"
+
+################################
+## Functions
+################################
+
+variantPath() {
+  case $1 in
+  global) echo "$COMPILED_DIR/global" ;;
+  *) echo "$COMPILED_DIR/per-vci-$1" ;;
+  esac
+}
+
+buildVariant() {
+  variant=$1
+  if test "$build" = false; then
+    return 0
+  fi
+  echo "$LOG_PREFIX Build MPICH variant $variant"
+  cd "$SCRIPT_DIR" || exit 1
+  if test "$variant" = "global"; then
+    eval "sh installMPICH.sh -g -s -r $installOpts"
+  else
+    eval "sh installMPICH.sh -p $variant -s -r $installOpts"
+  fi
+}
+
+buildPerftest() {
+  variant=$1
+  prefix=$(variantPath "$variant")
+  dir="$BENCH_DIR/$variant/perftest"
+
+  echo "$LOG_PREFIX Build perftest-1.5 against $prefix"
+  rm -rf "$dir"
+  mkdir -p "$dir"
+  cp -a "$PERFTEST_SRC/." "$dir/"
+  cd "$dir" || exit 1
+  ./configure CC="$prefix/bin/mpicc" --with-mpi="$prefix" >> "$BENCH_DIR/$variant/build.log" 2>&1 &&
+    make mpptest goptest stress >> "$BENCH_DIR/$variant/build.log" 2>&1
+  status=$?
+  cd "$SCRIPT_DIR" || exit 1
+  return $status
+}
+
+# runTest variant mode test program args...
+# Appends "variant mode test latency(us) rate(msg/s) bandwidth(MB/s)" to $RESULTS.
+# The rate is 1/latency, so it is only reported for the -window stream.
+runTest() {
+  variant=$1
+  mode=$2
+  test=$3
+  program=$4
+  shift 4
+  prefix=$(variantPath "$variant")
+  threadArg=""
+  if test "$mode" = "mt"; then
+    threadArg="-threadmultiple"
+  fi
+  stream=0
+  case " $* " in
+  *" -window "*) stream=1 ;;
+  esac
+  # goptest has neither -threadmultiple nor -quick
+  optArgs="$threadArg $quickArg"
+  if test "$program" = "goptest"; then
+    optArgs=""
+  fi
+
+  echo "$LOG_PREFIX $variant $mode $test"
+  # shellcheck disable=SC2086
+  "$prefix/bin/mpiexec" -n "$np" "$BENCH_DIR/$variant/perftest/$program" \
+    $optArgs "$@" > "$BENCH_DIR/$variant/$mode-$test.out" 2>&1
+  # mpptest data lines: p0 p1 dist len time(us) rate(bytes/s);
+  # goptest data lines: np time(us)...
+  awk -v variant="$variant" -v mode="$mode" -v test="$test" -v stream="$stream" '
+    /^[0-9]/ {
+      if (NF >= 6) { len = $4; t = $5 } else { len = 0; t = $2 }
+    }
+    END {
+      if (t == "") { print variant, mode, test, "-", "-", "-"; exit }
+      msgs = stream && t > 0 ? sprintf("%.0f", 1e6 / t) : "-"
+      bw = t > 0 && len > 0 ? sprintf("%.1f", len / t) : "-"
+      printf "%s %s %s %.2f %s %s\n", variant, mode, test, t, msgs, bw
+    }' "$BENCH_DIR/$variant/$mode-$test.out" >> "$RESULTS"
+}
+
+runMatrix() {
+  variant=$1
+  for mode in st mt; do
+    runTest "$variant" "$mode" pingpong mpptest -size 8 8 1
+    if test "$mode" = "mt"; then
+      runTest "$variant" mt msgrate mpptest -async -window 64 -threads "$threads" -size 8 8 1
+    else
+      runTest "$variant" st msgrate mpptest -async -window 64 -size 8 8 1
+    fi
+    runTest "$variant" "$mode" bandwidth mpptest -size 1048576 1048576 1
+    runTest "$variant" "$mode" halo mpptest -halo -size 1024 1024 1
+  done
+  runTest "$variant" st allreduce goptest -dsum -size 8 8 1
+  echo "$LOG_PREFIX $variant st stress"
+  prefix=$(variantPath "$variant")
+  if "$prefix/bin/mpiexec" -n "$np" "$BENCH_DIR/$variant/perftest/stress" -async \
+    -size 0 1024 256 -quiet > "$BENCH_DIR/$variant/st-stress.out" 2>&1; then
+    echo "$variant st stress:ok - - -" >> "$RESULTS"
+  else
+    echo "$variant st stress:FAILED - - -" >> "$RESULTS"
+  fi
+}
+
+printTable() {
+  awk 'BEGIN {
+         printf "%-10s %-4s %-10s %14s %14s %14s\n", "variant", "mode", "test",
+                "latency(us)", "rate(msg/s)", "bw(MB/s)"
+       }
+       { printf "%-10s %-4s %-10s %14s %14s %14s\n", $1, $2, $3, $4, $5, $6 }' "$RESULTS"
+}
+
+################################
+## Entry point
+################################
+
+variants="global,trylock,handoff"
+np=2
+threads=4
+build=true
+installOpts=""
+tableFile=""
+quickArg=""
+
+while getopts ":V:n:T:BO:o:qh" opt; do
+  case $opt in
+  V) variants=${OPTARG} ;;
+  n) np=${OPTARG} ;;
+  T) threads=${OPTARG} ;;
+  B) build=false ;;
+  O) installOpts=${OPTARG} ;;
+  o) tableFile=${OPTARG} ;;
+  q) quickArg="-quick" ;;
+  h)
+    echo "	$HELP"
+    exit 0
+    ;;
+  \? | :)
+    echo "$LOG_PREFIX Wrong option -$OPTARG$HELP"
+    exit 1
+    ;;
+  esac
+done
+
+mkdir -p "$BENCH_DIR"
+RESULTS="$BENCH_DIR/results.txt"
+: > "$RESULTS"
+
+for variant in $(echo "$variants" | tr ',' ' '); do
+  case $variant in
+  global | trylock | handoff | hybrid) ;;
+  *)
+    echo "$LOG_PREFIX Unknown variant $variant, global, trylock, handoff or hybrid only!"
+    exit 1
+    ;;
+  esac
+  mkdir -p "$BENCH_DIR/$variant"
+  : > "$BENCH_DIR/$variant/build.log"
+  if ! buildVariant "$variant"; then
+    echo "$LOG_PREFIX MPICH build failed for $variant, see installationLogs.txt"
+    continue
+  fi
+  if test ! -x "$(variantPath "$variant")/bin/mpiexec"; then
+    echo "$LOG_PREFIX No MPICH installation for $variant, skipped"
+    continue
+  fi
+  if ! buildPerftest "$variant"; then
+    echo "$LOG_PREFIX perftest build failed for $variant, see $BENCH_DIR/$variant/build.log"
+    continue
+  fi
+  runMatrix "$variant"
+done
+
+printTable
+if test -n "$tableFile"; then
+  printTable > "$tableFile"
+fi
+
+exit 0
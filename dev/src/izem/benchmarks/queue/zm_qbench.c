@@ -0,0 +1,569 @@
+/* -*- Mode: C; c-basic-offset:4 ; indent-tabs-mode:nil ; -*- */
+/*
+ * See COPYRIGHT in top-level directory.
+ */
+
+/* zm_qbench: standalone producer/consumer benchmark for izem queues.
+ *
+ * For every combination of queue, pinning layout, producer count,
+ * consumer count, batch size and payload pattern it reports throughput,
+ * rdtsc-based per-operation latency percentiles and hardware cache
+ * misses (via perf_event_open, when the kernel allows it).
+ *
+ * With a batch size above 1 producers hand each batch to the queue's bulk
+ * enqueue and consumers drain up to a batch per bulk dequeue (swpqueue
+ * has native bulk calls; the other queues loop over the single-item
+ * ones).  Latency percentiles are then per bulk call, not per item.
+ *
+ * Usage: zm_qbench [-q queues] [-l layouts] [-p producers] [-c consumers]
+ *                  [-b batches] [-d payloads] [-n items per producer]
+ * Every option takes a comma separated list, e.g. -p 1,2,4 -l core,cross
+ *   queues:   glqueue, msqueue, faqueue, swpqueue, multqueue, elimqueue
+ *   layouts:  none, core (SMT siblings first), socket (one PU per core
+ *             on the same package), cross (producers and consumers on
+ *             different packages)
+ *   payloads: ptr (no memory touched), line (64 bytes), page (4 KiB)
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <hwloc.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "queue/zm_glqueue.h"
+#include "queue/zm_msqueue.h"
+#include "queue/zm_faqueue.h"
+#include "queue/zm_swpqueue.h"
+#include "queue/zm_multqueue.h"
+#include "queue/zm_elimqueue.h"
+#include "queue/zm_queue.h"
+#include "common/zm_tsc.h"
+
+#define MAX_LIST      16
+#define MAX_SAMPLES   (1 << 16) /* latency samples kept per thread */
+#define COUNT_FLUSH   64        /* consumers publish progress every N items */
+
+/* ---------------------------------------------------------------- */
+/* Timing                                                            */
+/* ---------------------------------------------------------------- */
+
+static inline double wtime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* ---------------------------------------------------------------- */
+/* Queue backends                                                    */
+/* ---------------------------------------------------------------- */
+
+typedef struct {
+    const char *name;
+    int single_consumer;
+    int (*init)(void *q);
+    int (*enqueue)(void *q, void *data);
+    int (*dequeue)(void *q, void **data);
+    /* NULL: loop over enqueue/dequeue */
+    int (*enqueue_bulk)(void *q, void **data, int n);
+    int (*dequeue_bulk)(void *q, void **data, int max);
+} bench_queue_t;
+
+static int elim_init(void *q) {
+    return zm_elimqueue_init((zm_elimqueue_t *)q, ZM_MSQUEUE_IF);
+}
+
+#define QUEUE_OPS(n) \
+    (int (*)(void *))zm_##n##_init, \
+    (int (*)(void *, void *))zm_##n##_enqueue, \
+    (int (*)(void *, void **))zm_##n##_dequeue
+
+static const bench_queue_t queues[] = {
+    {"glqueue",   0, QUEUE_OPS(glqueue), NULL, NULL},
+    {"msqueue",   0, QUEUE_OPS(msqueue), NULL, NULL},
+    {"faqueue",   0, QUEUE_OPS(faqueue), NULL, NULL},
+    {"swpqueue",  1, QUEUE_OPS(swpqueue),
+        (int (*)(void *, void **, int))zm_swpqueue_enqueue_bulk,
+        (int (*)(void *, void **, int))zm_swpqueue_dequeue_bulk},
+    {"multqueue", 0, QUEUE_OPS(multqueue), NULL, NULL},
+    {"elimqueue", 0, elim_init,
+        (int (*)(void *, void *))zm_elimqueue_enqueue,
+        (int (*)(void *, void **))zm_elimqueue_dequeue,
+        NULL, NULL},
+};
+
+static int enqueue_bulk(const bench_queue_t *qops, void *q, void **data, int n) {
+    if (qops->enqueue_bulk)
+        return qops->enqueue_bulk(q, data, n);
+    for (int i = 0; i < n; i++)
+        qops->enqueue(q, data[i]);
+    return 0;
+}
+
+/* Returns the number of items dequeued */
+static int dequeue_bulk(const bench_queue_t *qops, void *q, void **data, int max) {
+    int n = 0;
+
+    if (qops->dequeue_bulk)
+        return qops->dequeue_bulk(q, data, max);
+    while (n < max) {
+        data[n] = NULL;
+        qops->dequeue(q, &data[n]);
+        if (data[n] == NULL)
+            break;
+        n++;
+    }
+    return n;
+}
+
+static const bench_queue_t *find_queue(const char *name) {
+    for (size_t i = 0; i < sizeof(queues) / sizeof(queues[0]); i++)
+        if (strcmp(queues[i].name, name) == 0)
+            return &queues[i];
+    return NULL;
+}
+
+/* ---------------------------------------------------------------- */
+/* Payloads                                                          */
+/* ---------------------------------------------------------------- */
+
+#define PAYLOAD_PTR  0
+#define PAYLOAD_LINE 1
+#define PAYLOAD_PAGE 2
+
+static const char *payload_names[] = {"ptr", "line", "page"};
+static const size_t payload_sizes[] = {0, 64, 4096};
+
+/* ---------------------------------------------------------------- */
+/* Pinning                                                           */
+/* ---------------------------------------------------------------- */
+
+static hwloc_topology_t topo;
+
+/* Fill pus[] with the PU objects threads are bound to, in order.
+ * Producers take pus[0..np-1], consumers pus[np..np+nc-1]. */
+static int layout_pus(const char *layout, int np, int nc, hwloc_obj_t *pus) {
+    int npu = hwloc_get_nbobjs_by_type(topo, HWLOC_OBJ_PU);
+    int ncore = hwloc_get_nbobjs_by_type(topo, HWLOC_OBJ_CORE);
+    int npkg = hwloc_get_nbobjs_by_type(topo, HWLOC_OBJ_PACKAGE);
+    int n = np + nc;
+
+    if (strcmp(layout, "none") == 0)
+        return 0;
+
+    if (strcmp(layout, "core") == 0) {
+        for (int i = 0; i < n; i++)
+            pus[i] = hwloc_get_obj_by_type(topo, HWLOC_OBJ_PU, i % npu);
+        return 0;
+    }
+
+    if (strcmp(layout, "socket") == 0) {
+        hwloc_obj_t pkg = hwloc_get_obj_by_type(topo, HWLOC_OBJ_PACKAGE, 0);
+        int incore = pkg ? hwloc_get_nbobjs_inside_cpuset_by_type(topo, pkg->cpuset,
+                                                                   HWLOC_OBJ_CORE) : ncore;
+        if (incore <= 0)
+            incore = ncore;
+        for (int i = 0; i < n; i++) {
+            hwloc_obj_t core = pkg ?
+                hwloc_get_obj_inside_cpuset_by_type(topo, pkg->cpuset, HWLOC_OBJ_CORE,
+                                                    i % incore) :
+                hwloc_get_obj_by_type(topo, HWLOC_OBJ_CORE, i % ncore);
+            pus[i] = hwloc_get_obj_inside_cpuset_by_type(topo, core->cpuset, HWLOC_OBJ_PU, 0);
+        }
+        return 0;
+    }
+
+    if (strcmp(layout, "cross") == 0) {
+        static int warned = 0;
+        if (npkg < 2) {
+            if (!warned++)
+                fprintf(stderr, "zm_qbench: cross layout needs two packages, skipping\n");
+            return -1;
+        }
+        for (int i = 0; i < n; i++) {
+            int side = (i < np) ? 0 : 1;
+            int idx = (i < np) ? i : i - np;
+            hwloc_obj_t pkg = hwloc_get_obj_by_type(topo, HWLOC_OBJ_PACKAGE, side);
+            int incore = hwloc_get_nbobjs_inside_cpuset_by_type(topo, pkg->cpuset,
+                                                                HWLOC_OBJ_CORE);
+            hwloc_obj_t core = hwloc_get_obj_inside_cpuset_by_type(topo, pkg->cpuset,
+                                                                   HWLOC_OBJ_CORE,
+                                                                   idx % incore);
+            pus[i] = hwloc_get_obj_inside_cpuset_by_type(topo, core->cpuset, HWLOC_OBJ_PU, 0);
+        }
+        return 0;
+    }
+
+    fprintf(stderr, "zm_qbench: unknown layout %s\n", layout);
+    return -1;
+}
+
+/* ---------------------------------------------------------------- */
+/* Cache-miss counter                                                */
+/* ---------------------------------------------------------------- */
+
+static int perf_open(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static inline void perf_start(int fd) {
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static inline long long perf_stop(int fd) {
+    long long count = -1;
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count))
+            count = -1;
+        close(fd);
+    }
+    return count;
+}
+
+/* ---------------------------------------------------------------- */
+/* Benchmark threads                                                 */
+/* ---------------------------------------------------------------- */
+
+typedef struct {
+    const bench_queue_t *qops;
+    void *q;
+    long items;        /* per producer */
+    long total;        /* over all producers */
+    int batch;
+    int payload;
+    pthread_barrier_t barrier;
+    zm_atomic_ulong_t consumed ZM_ALLIGN_TO_CACHELINE;
+} bench_shared_t;
+
+typedef struct {
+    bench_shared_t *shared;
+    hwloc_obj_t pu;
+    int producer;
+    int id;
+    uint64_t *samples;
+    long nsamples;
+    long long misses;
+    char *buffers;     /* producer payloads, freed after the run */
+    pthread_t thread;
+} bench_thread_t;
+
+static inline void record(bench_thread_t *t, long op, long stride, uint64_t cycles) {
+    if (op % stride == 0 && t->nsamples < MAX_SAMPLES)
+        t->samples[t->nsamples++] = cycles;
+}
+
+static void run_producer(bench_thread_t *t, long stride) {
+    bench_shared_t *s = t->shared;
+    size_t size = payload_sizes[s->payload];
+    char *buffers = NULL;
+    void **batch = malloc(sizeof(void *) * s->batch);
+
+    if (size > 0)
+        posix_memalign((void **) &buffers, ZM_CACHELINE_SIZE, size * s->batch);
+    t->buffers = buffers;
+
+    for (long i = 0; i < s->items; i += s->batch) {
+        long n = (s->items - i < s->batch) ? s->items - i : s->batch;
+        for (long j = 0; j < n; j++) {
+            if (size > 0) {
+                /* reuse the batch buffers: consumers may still read them, but
+                 * only the cache traffic matters here, not the content */
+                batch[j] = buffers + j * size;
+                memset(batch[j], (int)(i + j), size);
+            } else {
+                batch[j] = (void *)(zm_ptr_t)(((long)t->id << 40) | (i + j + 1));
+            }
+        }
+        uint64_t start = zm_tsc();
+        if (s->batch == 1)
+            s->qops->enqueue(s->q, batch[0]);
+        else
+            enqueue_bulk(s->qops, s->q, batch, (int)n);
+        record(t, i / s->batch, stride, zm_tsc() - start);
+    }
+    free(batch);
+}
+
+static void run_consumer(bench_thread_t *t, long stride) {
+    bench_shared_t *s = t->shared;
+    size_t size = payload_sizes[s->payload];
+    unsigned long local = 0;
+    long op = 0;
+    volatile char sink = 0;
+    void **batch = malloc(sizeof(void *) * s->batch);
+
+    while (zm_atomic_load(&s->consumed, zm_memord_relaxed) < (unsigned long)s->total) {
+        int n;
+        uint64_t start = zm_tsc();
+        if (s->batch == 1) {
+            batch[0] = NULL;
+            s->qops->dequeue(s->q, &batch[0]);
+            n = (batch[0] != NULL);
+        } else {
+            n = dequeue_bulk(s->qops, s->q, batch, s->batch);
+        }
+        uint64_t cycles = zm_tsc() - start;
+        if (n == 0) {
+            if (local) {
+                zm_atomic_fetch_add(&s->consumed, local, zm_memord_relaxed);
+                local = 0;
+            }
+            continue;
+        }
+        record(t, op++, stride, cycles);
+        for (int j = 0; j < n; j++)
+            for (size_t k = 0; k < size; k += ZM_CACHELINE_SIZE)
+                sink += ((char *)batch[j])[k];
+        local += n;
+        if (local >= COUNT_FLUSH) {
+            zm_atomic_fetch_add(&s->consumed, local, zm_memord_relaxed);
+            local = 0;
+        }
+    }
+    if (local)
+        zm_atomic_fetch_add(&s->consumed, local, zm_memord_relaxed);
+    free(batch);
+    (void)sink;
+}
+
+static void *bench_thread(void *arg) {
+    bench_thread_t *t = (bench_thread_t *) arg;
+    bench_shared_t *s = t->shared;
+    long stride = s->total / MAX_SAMPLES + 1;
+    int fd;
+
+    if (t->pu)
+        hwloc_set_cpubind(topo, t->pu->cpuset, HWLOC_CPUBIND_THREAD);
+    fd = perf_open();
+
+    pthread_barrier_wait(&s->barrier);
+    perf_start(fd);
+    if (t->producer)
+        run_producer(t, stride);
+    else
+        run_consumer(t, stride);
+    t->misses = perf_stop(fd);
+    pthread_barrier_wait(&s->barrier);
+    return NULL;
+}
+
+/* ---------------------------------------------------------------- */
+/* Statistics                                                        */
+/* ---------------------------------------------------------------- */
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void percentiles(bench_thread_t *threads, int from, int to,
+                        uint64_t *p50, uint64_t *p99, uint64_t *p999) {
+    long n = 0, k = 0;
+    uint64_t *all;
+
+    for (int i = from; i < to; i++)
+        n += threads[i].nsamples;
+    *p50 = *p99 = *p999 = 0;
+    if (n == 0)
+        return;
+    all = malloc(sizeof(uint64_t) * n);
+    for (int i = from; i < to; i++) {
+        memcpy(all + k, threads[i].samples, sizeof(uint64_t) * threads[i].nsamples);
+        k += threads[i].nsamples;
+    }
+    qsort(all, n, sizeof(uint64_t), cmp_u64);
+    *p50 = all[(n - 1) * 50 / 100];
+    *p99 = all[(n - 1) * 99 / 100];
+    *p999 = all[(n - 1) * 999 / 1000];
+    free(all);
+}
+
+/* ---------------------------------------------------------------- */
+/* Driver                                                            */
+/* ---------------------------------------------------------------- */
+
+static void run_config(const bench_queue_t *qops, const char *layout, int np, int nc,
+                       int batch, int payload, long items) {
+    bench_shared_t s;
+    bench_thread_t *threads;
+    hwloc_obj_t pus[2 * MAX_LIST * 64];
+    int n = np + nc;
+    void *q;
+    double t0, t1;
+    long long misses = 0;
+    int have_misses = 1;
+    uint64_t ep50, ep99, ep999, dp50, dp99, dp999;
+
+    if (qops->single_consumer && nc > 1)
+        return;
+    if (n > (int)(sizeof(pus) / sizeof(pus[0])))
+        return;
+    memset(pus, 0, sizeof(pus));
+    if (layout_pus(layout, np, nc, pus))
+        return;
+
+    if (posix_memalign(&q, ZM_CACHELINE_SIZE, sizeof(zm_queue_t)))
+        return;
+    qops->init(q);
+
+    memset(&s, 0, sizeof(s));
+    s.qops = qops;
+    s.q = q;
+    s.items = items;
+    s.total = items * np;
+    s.batch = batch;
+    s.payload = payload;
+    zm_atomic_store(&s.consumed, 0, zm_memord_relaxed);
+    pthread_barrier_init(&s.barrier, NULL, n + 1);
+
+    threads = calloc(n, sizeof(bench_thread_t));
+    for (int i = 0; i < n; i++) {
+        threads[i].shared = &s;
+        threads[i].pu = pus[i];
+        threads[i].producer = (i < np);
+        threads[i].id = i;
+        threads[i].samples = malloc(sizeof(uint64_t) * MAX_SAMPLES);
+        pthread_create(&threads[i].thread, NULL, bench_thread, &threads[i]);
+    }
+
+    pthread_barrier_wait(&s.barrier);
+    t0 = wtime();
+    pthread_barrier_wait(&s.barrier);
+    t1 = wtime();
+
+    for (int i = 0; i < n; i++) {
+        pthread_join(threads[i].thread, NULL);
+        if (threads[i].misses < 0)
+            have_misses = 0;
+        else
+            misses += threads[i].misses;
+    }
+
+    percentiles(threads, 0, np, &ep50, &ep99, &ep999);
+    percentiles(threads, np, n, &dp50, &dp99, &dp999);
+
+    printf("%-10s %-6s %3d %3d %5d %-5s %10.3f %8lu %8lu %8lu %8lu %8lu %8lu ",
+           qops->name, layout, np, nc, batch, payload_names[payload],
+           s.total / (t1 - t0) * 1e-6,
+           (unsigned long)ep50, (unsigned long)ep99, (unsigned long)ep999,
+           (unsigned long)dp50, (unsigned long)dp99, (unsigned long)dp999);
+    if (have_misses)
+        printf("%10.2f\n", (double)misses / s.total);
+    else
+        printf("%10s\n", "n/a");
+    fflush(stdout);
+
+    for (int i = 0; i < n; i++) {
+        free(threads[i].samples);
+        free(threads[i].buffers);
+    }
+    free(threads);
+    pthread_barrier_destroy(&s.barrier);
+    /* queues have no destroy routine; the remaining sentinel leaks */
+    free(q);
+}
+
+static int split(char *arg, char **list) {
+    int n = 0;
+    for (char *tok = strtok(arg, ","); tok && n < MAX_LIST; tok = strtok(NULL, ","))
+        list[n++] = tok;
+    return n;
+}
+
+static int split_int(char *arg, int *list) {
+    char *strs[MAX_LIST];
+    int n = split(arg, strs);
+    for (int i = 0; i < n; i++)
+        list[i] = atoi(strs[i]);
+    return n;
+}
+
+int main(int argc, char **argv) {
+    char qarg[256] = "glqueue,msqueue,faqueue,swpqueue,elimqueue";
+    char larg[256] = "none,core,socket,cross";
+    char parg[256] = "1,2,4";
+    char carg[256] = "1,2";
+    char barg[256] = "1,16";
+    char darg[256] = "ptr,line";
+    long items = 1000000;
+    char *qnames[MAX_LIST], *lnames[MAX_LIST], *dnames[MAX_LIST];
+    int prods[MAX_LIST], cons[MAX_LIST], batches[MAX_LIST];
+    int nq, nl, np, nc, nb, nd;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q:l:p:c:b:d:n:h")) != -1) {
+        switch (opt) {
+            case 'q': snprintf(qarg, sizeof(qarg), "%s", optarg); break;
+            case 'l': snprintf(larg, sizeof(larg), "%s", optarg); break;
+            case 'p': snprintf(parg, sizeof(parg), "%s", optarg); break;
+            case 'c': snprintf(carg, sizeof(carg), "%s", optarg); break;
+            case 'b': snprintf(barg, sizeof(barg), "%s", optarg); break;
+            case 'd': snprintf(darg, sizeof(darg), "%s", optarg); break;
+            case 'n': items = atol(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-q queues] [-l layouts] [-p producers] "
+                        "[-c consumers] [-b batches] [-d payloads] [-n items]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    nq = split(qarg, qnames);
+    nl = split(larg, lnames);
+    np = split_int(parg, prods);
+    nc = split_int(carg, cons);
+    nb = split_int(barg, batches);
+    nd = split(darg, dnames);
+
+    hwloc_topology_init(&topo);
+    hwloc_topology_load(topo);
+
+    printf("# latencies in ticks per call (a whole batch when batch > 1); "
+           "misses are hardware cache misses per item\n");
+    printf("%-10s %-6s %3s %3s %5s %-5s %10s %8s %8s %8s %8s %8s %8s %10s\n",
+           "queue", "layout", "P", "C", "batch", "load", "Mops/s",
+           "enq50", "enq99", "enq99.9", "deq50", "deq99", "deq99.9", "misses/op");
+
+    for (int iq = 0; iq < nq; iq++) {
+        const bench_queue_t *qops = find_queue(qnames[iq]);
+        if (qops == NULL) {
+            fprintf(stderr, "zm_qbench: unknown queue %s\n", qnames[iq]);
+            continue;
+        }
+        for (int il = 0; il < nl; il++)
+            for (int ip = 0; ip < np; ip++)
+                for (int ic = 0; ic < nc; ic++)
+                    for (int ib = 0; ib < nb; ib++)
+                        for (int id = 0; id < nd; id++) {
+                            int payload = -1;
+                            for (int k = 0; k < 3; k++)
+                                if (strcmp(dnames[id], payload_names[k]) == 0)
+                                    payload = k;
+                            if (payload < 0 || batches[ib] < 1)
+                                continue;
+                            run_config(qops, lnames[il], prods[ip], cons[ic],
+                                       batches[ib], payload, items);
+                        }
+    }
+
+    hwloc_topology_destroy(topo);
+    return 0;
+}
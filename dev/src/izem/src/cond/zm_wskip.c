@@ -3,10 +3,24 @@
  * See COPYRIGHT in top-level directory.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* sched_getcpu */
+#endif
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
 #include <hwloc.h>
 #include "lock/zm_mcs.h"
 #include "cond/zm_wskip.h"
+#include "common/zm_tsc.h"
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 #define ZM_WAIT 0
 #define ZM_WAKE 1
@@ -14,56 +28,460 @@
 #define ZM_RECYCLE 3
 #define ZM_CHECK 4
 
+/* waiting policies, selected with ZM_WSKIP_WAIT_MODE=spin|hybrid */
+#define ZM_WSKIP_SPIN   0 /* spin with pause and bounded backoff */
+#define ZM_WSKIP_HYBRID 1 /* spin for a calibrated time, then park */
+
+#define ZM_WSKIP_SPIN_NS      10000 /* default spin budget before parking */
+#define ZM_WSKIP_MAX_BACKOFF  16    /* max pauses between two polls */
+
+#define ZM_WSKIP_PRIO_WINDOW      8  /* waiters inspected for a promotion */
+#define ZM_WSKIP_PRIO_MAX_BYPASS  16 /* promotions before a FIFO handoff */
+
+#define ZM_WSKIP_TTAS_SPINS       128 /* fast-path polls before inflating */
+#define ZM_WSKIP_DEFLATE_QUIET    64  /* uncontended releases before deflating */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ZM_WSKIP_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define ZM_WSKIP_RELAX() __asm__ __volatile__ ("yield" ::: "memory")
+#else
+#define ZM_WSKIP_RELAX() __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+#ifdef ZM_WSKIP_PROFILE
+/* Opt-in profiling build (-DZM_WSKIP_PROFILE). Each qnode belongs to
+ * one thread and one lock, so it carries that thread's histograms and
+ * only its owner writes them. They are printed by zm_wskip_destroy(),
+ * to stderr or appended to the file named by ZM_WSKIP_PROFILE_FILE.
+ * Bucket b > 0 counts values in [2^(b-1), 2^b); bucket 0 counts zeros. */
+#define ZM_WSKIP_PROF_BUCKETS 48
+
+struct wskip_prof {
+    zm_ulong_t tid;           /* profiling index of the owner thread */
+    zm_ulong_t t_enq;         /* tsc when the node entered the queue */
+    zm_ulong_t t_acq;         /* tsc when the lock was granted, 0 if not held */
+    zm_ulong_t nskips;        /* skips since the last acquisition */
+    zm_ulong_t acquires, skips;
+    zm_ulong_t wait[ZM_WSKIP_PROF_BUCKETS];     /* enqueue -> grant, cycles */
+    zm_ulong_t hold[ZM_WSKIP_PROF_BUCKETS];     /* grant -> release, cycles */
+    zm_ulong_t skipped[ZM_WSKIP_PROF_BUCKETS];  /* skips before each grant */
+    zm_ulong_t distance[ZM_WSKIP_PROF_BUCKETS]; /* skipped nodes passed per release */
+};
+
+static zm_atomic_ulong_t wskip_prof_tids;
+static zm_thread_local zm_ulong_t tls_prof_tid = 0;
+
+static inline void prof_record(zm_ulong_t *hist, zm_ulong_t value) {
+    int b = value ? 64 - __builtin_clzl(value) : 0;
+    hist[b < ZM_WSKIP_PROF_BUCKETS ? b : ZM_WSKIP_PROF_BUCKETS - 1]++;
+}
+#endif /* ZM_WSKIP_PROFILE */
+
+/* Queue node owned by one thread for one lock. The MCS node must stay
+ * first: the public API hands out zm_mcs_qnode_t pointers. */
+struct zm_wskip_qnode {
+    zm_mcs_qnode_t mcs;
+    struct zm_wskip_qnode *reg_next; /* registry link, see new_node() */
+    zm_atomic_int_t parked;          /* owner sleeps in futex_wait */
+    zm_ulong_t lock_id;              /* id of the lock this node queues on */
+    zm_atomic_int_t gone;            /* WSKIP_LOCK_GONE | WSKIP_THREAD_GONE */
+    int prio;                        /* priority class, higher goes first */
+    int fast;                        /* holds the lock through the TTAS word */
+    int ttas_held;                   /* set the TTAS word, fast or queued */
+#ifdef ZM_WSKIP_PROFILE
+    struct wskip_prof prof;
+#endif
+};
+
+#define WSKIP_NODE(I) ((struct zm_wskip_qnode *)(I))
+
+#define WSKIP_LOCK_GONE   1 /* the lock was destroyed */
+#define WSKIP_THREAD_GONE 2 /* the owner thread exited */
+
 struct zm_mcs {
     zm_atomic_ptr_t lock;
-    struct zm_mcs_qnode *local_nodes;
-    hwloc_topology_t topo;
+    int wait_mode;
+    zm_ulong_t id;         /* key of this lock in the per-thread caches */
+    zm_atomic_ptr_t nodes; /* every qnode allocated for this lock */
+    zm_atomic_int_t use_prio; /* set once any waiter asked for a priority */
+    int bypasses;          /* consecutive promotions, owned by the holder */
+    int adaptive;          /* TTAS fast path enabled, see fast_acquire() */
+    zm_atomic_int_t ttas;  /* the mutex proper in adaptive mode */
+    zm_atomic_int_t inflated; /* contention seen: acquirers use the queue */
+    int quiet;             /* consecutive uncontended queue releases */
+    zm_atomic_int_t readers ZM_ALLIGN_TO_CACHELINE; /* active readers */
 };
 
-static zm_thread_local int tid = -1;
+/* Per-thread cache of the qnodes this thread allocated: an open
+ * addressing table keyed by lock id, so a thread alternating between
+ * many locks still finds its node in O(1). Ids are never reused, so the
+ * entry of a destroyed lock cannot alias a new lock allocated at the
+ * same address. The node is freed by whichever of zm_wskip_destroy()
+ * and the owner thread lets go of it last (see node_release()); dead
+ * entries are pruned when the table grows and at thread exit. */
+struct wskip_tls_entry {
+    zm_ulong_t id;             /* 0: empty slot */
+    struct zm_wskip_qnode *node;
+};
 
-/* Check the actual affinity mask assigned to the thread */
-static inline void check_affinity(hwloc_topology_t topo) {
-    hwloc_cpuset_t cpuset = hwloc_bitmap_alloc();
-    int set_length;
-    hwloc_get_cpubind(topo, cpuset, HWLOC_CPUBIND_THREAD);
-    set_length = hwloc_get_nbobjs_inside_cpuset_by_type(topo, cpuset, HWLOC_OBJ_PU);
-    hwloc_bitmap_free(cpuset);
+struct wskip_tls {
+    int capacity;              /* power of two */
+    int nnodes;
+    struct wskip_tls_entry *entries;
+};
+
+static zm_atomic_ulong_t wskip_ids;
+static pthread_key_t wskip_tls_key;
+static pthread_once_t wskip_tls_once = PTHREAD_ONCE_INIT;
+static zm_thread_local struct wskip_tls *tls_nodes = NULL;
+static zm_thread_local zm_ulong_t tls_last_id = 0;
+static zm_thread_local struct zm_wskip_qnode *tls_last_node = NULL;
+
+#ifdef ZM_WSKIP_PROFILE
+static inline void prof_init(struct zm_wskip_qnode *node) {
+    memset(&node->prof, 0, sizeof(node->prof));
+    if (tls_prof_tid == 0)
+        tls_prof_tid = zm_atomic_fetch_add(&wskip_prof_tids, 1, zm_memord_relaxed) + 1;
+    node->prof.tid = tls_prof_tid;
+}
+
+static inline void prof_enq(zm_mcs_qnode_t *I) {
+    WSKIP_NODE(I)->prof.t_enq = zm_tsc();
+}
+
+static inline void prof_acquired(zm_mcs_qnode_t *I) {
+    struct wskip_prof *p = &WSKIP_NODE(I)->prof;
+    p->t_acq = zm_tsc();
+    prof_record(p->wait, p->t_acq - p->t_enq);
+    prof_record(p->skipped, p->nskips);
+    p->nskips = 0;
+    p->acquires++;
+}
 
-    if(set_length != 1) {
-        printf("IZEM:WSKIP:ERROR: thread bound to more than one HW thread!\n");
-        exit(EXIT_FAILURE);
+static inline void prof_release(zm_mcs_qnode_t *I) {
+    struct wskip_prof *p = &WSKIP_NODE(I)->prof;
+    if (p->t_acq) {
+        prof_record(p->hold, zm_tsc() - p->t_acq);
+        p->t_acq = 0;
     }
 }
 
-static inline int get_hwthread_id(hwloc_topology_t topo){
-    hwloc_cpuset_t cpuset = hwloc_bitmap_alloc();
-    hwloc_obj_t obj;
-    hwloc_get_cpubind(topo, cpuset, HWLOC_CPUBIND_THREAD);
-    obj = hwloc_get_obj_inside_cpuset_by_type(topo, cpuset, HWLOC_OBJ_PU, 0);
-    hwloc_bitmap_free(cpuset);
-    return obj->logical_index;
+static inline void prof_handoff(zm_mcs_qnode_t *I, zm_ulong_t passed) {
+    prof_record(WSKIP_NODE(I)->prof.distance, passed);
 }
 
-static void* new_wskip() {
-    int max_threads;
-    struct zm_mcs_qnode *qnodes;
+static inline void prof_skipped(zm_mcs_qnode_t *I) {
+    WSKIP_NODE(I)->prof.skips++;
+    WSKIP_NODE(I)->prof.nskips++;
+}
 
+static void prof_print_hist(FILE *out, const char *name, const zm_ulong_t *hist) {
+    fprintf(out, "  %-9s", name);
+    for (int b = 0; b < ZM_WSKIP_PROF_BUCKETS; b++)
+        if (hist[b])
+            fprintf(out, " %s%d:%lu", b ? "<2^" : "=", b, hist[b]);
+    fprintf(out, "\n");
+}
 
-    struct zm_mcs *L;
-    posix_memalign((void **) &L, ZM_CACHELINE_SIZE, sizeof(struct zm_mcs));
+static void prof_dump(struct zm_mcs *L) {
+    const char *path = getenv("ZM_WSKIP_PROFILE_FILE");
+    FILE *out = path ? fopen(path, "a") : NULL;
+    struct zm_wskip_qnode *node = (struct zm_wskip_qnode *)
+        zm_atomic_load(&L->nodes, zm_memord_acquire);
 
-    hwloc_topology_init(&L->topo);
-    hwloc_topology_load(L->topo);
+    if (out == NULL)
+        out = stderr;
+    for (; node != NULL; node = node->reg_next) {
+        struct wskip_prof *p = &node->prof;
+        if (p->acquires == 0 && p->skips == 0)
+            continue;
+        fprintf(out, "zm_wskip lock %lu thread %lu: acquires %lu skips %lu\n",
+                L->id, p->tid, p->acquires, p->skips);
+        prof_print_hist(out, "wait", p->wait);
+        prof_print_hist(out, "hold", p->hold);
+        prof_print_hist(out, "skips", p->skipped);
+        prof_print_hist(out, "distance", p->distance);
+    }
+    if (out != stderr)
+        fclose(out);
+}
+#else
+static inline void prof_init(struct zm_wskip_qnode *node) { (void)node; }
+static inline void prof_enq(zm_mcs_qnode_t *I) { (void)I; }
+static inline void prof_acquired(zm_mcs_qnode_t *I) { (void)I; }
+static inline void prof_release(zm_mcs_qnode_t *I) { (void)I; }
+static inline void prof_handoff(zm_mcs_qnode_t *I, zm_ulong_t passed) { (void)I; (void)passed; }
+static inline void prof_skipped(zm_mcs_qnode_t *I) { (void)I; }
+static inline void prof_dump(struct zm_mcs *L) { (void)L; }
+#endif /* ZM_WSKIP_PROFILE */
 
-    max_threads = hwloc_get_nbobjs_by_type(L->topo, HWLOC_OBJ_PU);
+/* Number of pause instructions that fit in the spin budget, measured
+ * once per process. */
+static unsigned wskip_spin_budget;
+static pthread_once_t wskip_calibrated = PTHREAD_ONCE_INIT;
 
-    posix_memalign((void **) &qnodes, ZM_CACHELINE_SIZE, sizeof(struct zm_mcs_qnode) * max_threads);
-    for (int i = 0; i < max_threads; i ++)
-        zm_atomic_store(&qnodes[i].status, ZM_RECYCLE, zm_memord_release);
+static void calibrate(void) {
+    const unsigned probe = 100000;
+    const char *env = getenv("ZM_WSKIP_SPIN_NS");
+    long spin_ns = env ? atol(env) : ZM_WSKIP_SPIN_NS;
+    struct timespec t0, t1;
+    double ns;
 
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (unsigned i = 0; i < probe; i++)
+        ZM_WSKIP_RELAX();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    if (ns <= 0)
+        ns = 1;
+    wskip_spin_budget = (unsigned)(spin_ns * (probe / ns));
+}
+
+static inline void futex_wait(zm_atomic_int_t *addr, int val, const struct timespec *timeout) {
+#if defined(__linux__)
+    syscall(SYS_futex, (int *)addr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+#else
+    (void)addr; (void)val; (void)timeout;
+    sched_yield();
+#endif
+}
+
+static inline void futex_wake(zm_atomic_int_t *addr) {
+#if defined(__linux__)
+    syscall(SYS_futex, (int *)addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    (void)addr;
+#endif
+}
+
+static inline int acquired(int status) {
+    return status == ZM_WAKE || status == ZM_RECYCLE;
+}
+
+/* One step of a plain spin loop. In hybrid mode the CPU is given up
+ * whenever the spin budget is exhausted; these loops wait for a single
+ * short-lived holder, so there is nothing to park on. */
+static inline void spin_once(int wait_mode, unsigned *spins) {
+    ZM_WSKIP_RELAX();
+    if (wait_mode == ZM_WSKIP_HYBRID && ++(*spins) >= wskip_spin_budget) {
+        sched_yield();
+        *spins = 0;
+    }
+}
+
+/* Sleep until the status word moves away from status. The parked flag
+ * and the status word form a Dekker pair with hand(): either the
+ * waker sees parked and issues a futex wake, or we see the new status. */
+static inline void park(zm_mcs_qnode_t *I, int status, const struct timespec *timeout) {
+    struct zm_wskip_qnode *node = WSKIP_NODE(I);
+    zm_atomic_store(&node->parked, 1, zm_memord_seq_cst);
+    if (zm_atomic_load(&I->status, zm_memord_seq_cst) == status)
+        futex_wait(&I->status, status, timeout);
+    zm_atomic_store(&node->parked, 0, zm_memord_relaxed);
+}
+
+/* Nanoseconds left until deadline, or 0 once it has passed. */
+static inline long remaining_ns(const struct timespec *deadline) {
+    struct timespec now;
+    long ns;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (deadline->tv_sec - now.tv_sec) * 1000000000L + (deadline->tv_nsec - now.tv_nsec);
+    return ns > 0 ? ns : 0;
+}
+
+#define ZM_WSKIP_CLOCK_POLLS 64 /* polls between two deadline checks */
+
+/* Wait until the node is handed the lock. Returns 0 if it was, or
+ * ZM_WSKIP_ETIMEDOUT if deadline (optional) passed first. */
+static inline int wait_status(struct zm_mcs *L, zm_mcs_qnode_t *I,
+                              const struct timespec *deadline) {
+    unsigned spins = 0, backoff = 1, polls = 0;
+    int status;
+    while (!acquired(status = zm_atomic_load(&I->status, zm_memord_acquire))) {
+        long left = 1;
+        if (deadline && ++polls % ZM_WSKIP_CLOCK_POLLS == 0 &&
+            (left = remaining_ns(deadline)) == 0)
+            return ZM_WSKIP_ETIMEDOUT;
+        if (L->wait_mode == ZM_WSKIP_HYBRID && spins >= wskip_spin_budget) {
+            struct timespec timeout;
+            if (deadline) {
+                left = remaining_ns(deadline);
+                if (left == 0)
+                    return ZM_WSKIP_ETIMEDOUT;
+                timeout.tv_sec = left / 1000000000L;
+                timeout.tv_nsec = left % 1000000000L;
+            }
+            park(I, status, deadline ? &timeout : NULL);
+            continue;
+        }
+        for (unsigned i = 0; i < backoff; i++)
+            ZM_WSKIP_RELAX();
+        spins += backoff;
+        if (backoff < ZM_WSKIP_MAX_BACKOFF)
+            backoff <<= 1;
+    }
+    return 0;
+}
+
+/* Drop one of the two references to a node (the lock's registry and
+ * the owner thread's cache); the second one frees it. */
+static inline void node_release(struct zm_wskip_qnode *node, int who) {
+    if (zm_atomic_fetch_add(&node->gone, who, zm_memord_acq_rel) != 0)
+        free(node);
+}
+
+static inline int tls_slot(struct wskip_tls *t, zm_ulong_t id) {
+    int mask = t->capacity - 1;
+    int i = (int)(id & mask);
+    while (t->entries[i].id != 0 && t->entries[i].id != id)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/* Rehash into a table of the given capacity, pruning the entries of
+ * destroyed locks on the way */
+static void tls_rehash(struct wskip_tls *t, int capacity) {
+    struct wskip_tls_entry *old = t->entries;
+    int old_capacity = t->capacity;
+
+    t->entries = calloc(capacity, sizeof(struct wskip_tls_entry));
+    t->capacity = capacity;
+    t->nnodes = 0;
+    for (int i = 0; i < old_capacity; i++) {
+        struct zm_wskip_qnode *node = old[i].node;
+        if (old[i].id == 0)
+            continue;
+        if (zm_atomic_load(&node->gone, zm_memord_acquire) & WSKIP_LOCK_GONE) {
+            node_release(node, WSKIP_THREAD_GONE);
+            continue;
+        }
+        t->entries[tls_slot(t, old[i].id)] = old[i];
+        t->nnodes++;
+    }
+    free(old);
+}
+
+/* Remove id from the table, shifting back the entries probed past it */
+static void tls_remove(struct wskip_tls *t, zm_ulong_t id) {
+    int mask = t->capacity - 1;
+    int i = tls_slot(t, id), j = i;
+
+    if (t->entries[i].id == 0)
+        return;
+    for (;;) {
+        int home;
+        t->entries[i].id = 0;
+        t->entries[i].node = NULL;
+        do {
+            j = (j + 1) & mask;
+            if (t->entries[j].id == 0) {
+                t->nnodes--;
+                return;
+            }
+            home = (int)(t->entries[j].id & mask);
+        } while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+        t->entries[i] = t->entries[j];
+        i = j;
+    }
+}
+
+/* Thread exit: hand every cached node back to its lock, or free it if
+ * the lock is already gone */
+static void tls_destroy(void *arg) {
+    struct wskip_tls *t = (struct wskip_tls *)arg;
+    for (int i = 0; i < t->capacity; i++)
+        if (t->entries[i].id != 0)
+            node_release(t->entries[i].node, WSKIP_THREAD_GONE);
+    free(t->entries);
+    free(t);
+}
+
+static void tls_key_create(void) {
+    pthread_key_create(&wskip_tls_key, tls_destroy);
+}
+
+static struct zm_wskip_qnode *new_node(struct zm_mcs *L) {
+    struct zm_wskip_qnode *node;
+    struct wskip_tls *t = tls_nodes;
+    zm_ptr_t head;
+
+    posix_memalign((void **) &node, ZM_CACHELINE_SIZE, sizeof(struct zm_wskip_qnode));
+    zm_atomic_store(&node->mcs.status, ZM_RECYCLE, zm_memord_release);
+    zm_atomic_store(&node->mcs.next, ZM_NULL, zm_memord_release);
+    zm_atomic_store(&node->parked, 0, zm_memord_release);
+    zm_atomic_store(&node->gone, 0, zm_memord_release);
+    node->lock_id = L->id;
+    node->prio = 0;
+    node->fast = 0;
+    node->ttas_held = 0;
+    prof_init(node);
+
+    /* push onto the lock registry so free_wskip() can reclaim it */
+    head = zm_atomic_load(&L->nodes, zm_memord_acquire);
+    do {
+        node->reg_next = (struct zm_wskip_qnode *)head;
+    } while (!zm_atomic_compare_exchange_weak(&L->nodes, &head, (zm_ptr_t)node,
+                                              zm_memord_acq_rel, zm_memord_acquire));
+
+    if (t == NULL) {
+        pthread_once(&wskip_tls_once, tls_key_create);
+        t = calloc(1, sizeof(struct wskip_tls));
+        tls_nodes = t;
+        pthread_setspecific(wskip_tls_key, t);
+    }
+    /* keep the load factor at or below 1/2 */
+    if (2 * (t->nnodes + 1) > t->capacity) {
+        tls_rehash(t, t->capacity ? t->capacity : 8);
+        if (2 * (t->nnodes + 1) > t->capacity)
+            tls_rehash(t, 2 * t->capacity);
+    }
+    t->entries[tls_slot(t, L->id)] = (struct wskip_tls_entry) {L->id, node};
+    t->nnodes++;
+    tls_last_id = L->id;
+    tls_last_node = node;
+
+    return node;
+}
+
+/* Return the calling thread's qnode for L, allocating it on first use.
+ * Nodes belong to threads rather than to hardware threads, so several
+ * threads sharing a PU (or floating in a cpuset) never share a node. */
+static inline struct zm_wskip_qnode *get_node(struct zm_mcs *L) {
+    struct wskip_tls *t = tls_nodes;
+    int i;
+
+    if (zm_likely(tls_last_id == L->id))
+        return tls_last_node;
+    if (t == NULL)
+        return new_node(L);
+    i = tls_slot(t, L->id);
+    if (t->entries[i].id == 0)
+        return new_node(L);
+    tls_last_id = L->id;
+    tls_last_node = t->entries[i].node;
+    return tls_last_node;
+}
+
+static void* new_wskip() {
+    struct zm_mcs *L;
+    const char *mode = getenv("ZM_WSKIP_WAIT_MODE");
+    const char *adaptive = getenv("ZM_WSKIP_ADAPTIVE");
+    posix_memalign((void **) &L, ZM_CACHELINE_SIZE, sizeof(struct zm_mcs));
+
+    pthread_once(&wskip_calibrated, calibrate);
+    L->wait_mode = (mode && strcmp(mode, "hybrid") == 0) ? ZM_WSKIP_HYBRID : ZM_WSKIP_SPIN;
+
+    L->id = zm_atomic_fetch_add(&wskip_ids, 1, zm_memord_relaxed) + 1;
+    zm_atomic_store(&L->nodes, ZM_NULL, zm_memord_release);
     zm_atomic_store(&L->lock, (zm_ptr_t)ZM_NULL, zm_memord_release);
-    L->local_nodes = qnodes;
+    zm_atomic_store(&L->use_prio, 0, zm_memord_release);
+    L->bypasses = 0;
+    L->adaptive = adaptive && atoi(adaptive) != 0;
+    zm_atomic_store(&L->ttas, 0, zm_memord_release);
+    zm_atomic_store(&L->inflated, 0, zm_memord_release);
+    L->quiet = 0;
+    zm_atomic_store(&L->readers, 0, zm_memord_release);
 
     return L;
 }
@@ -76,12 +494,15 @@ static inline int enq(struct zm_mcs *L, zm_mcs_qnode_t* I, int *wait) {
     int status = zm_atomic_exchange_int(&I->status, ZM_WAIT, zm_memord_acq_rel);
     /* wake() passed this node and is in the processs of setting it to RECYCLE */
     if(status == ZM_CHECK) {
-        while (status != ZM_RECYCLE)
+        while (status != ZM_RECYCLE) {
+            ZM_WSKIP_RELAX();
             status = zm_atomic_load(&I->status, zm_memord_acquire); /* wait */
+        }
         zm_atomic_store(&I->status, ZM_WAIT, zm_memord_release);
     }
 
     if (status == ZM_RECYCLE) {
+        prof_enq(I);
         zm_atomic_store(&I->next, ZM_NULL, zm_memord_release);
         pred = (zm_mcs_qnode_t*)zm_atomic_exchange_ptr(&L->lock, (zm_ptr_t)I, zm_memord_acq_rel);
         if((zm_ptr_t)pred == ZM_NULL) {
@@ -102,15 +523,230 @@ static inline int zm_wait(struct zm_mcs *L, zm_mcs_qnode_t* I) {
     enq(L,I, &wait);
     /* wait in line if necessary */
     if (wait)
-        while(zm_atomic_load(&I->status, zm_memord_acquire) != ZM_WAKE &&
-              zm_atomic_load(&I->status, zm_memord_acquire) != ZM_RECYCLE)
-            ; /* SPIN */
+        wait_status(L, I, NULL);
+    prof_acquired(I);
 
     return 0;
 }
 
-/* Release the lock */
-static inline int wake(struct zm_mcs *L, zm_mcs_qnode_t *I) {
+/* Take the lock only if nobody holds or waits for it. The node must be
+ * free (not still queued from an abandoned timed wait). */
+static inline int try_wait(struct zm_mcs *L, zm_mcs_qnode_t* I) {
+    zm_ptr_t expected = ZM_NULL;
+    if (zm_atomic_load(&I->status, zm_memord_acquire) != ZM_RECYCLE ||
+        zm_atomic_load(&L->lock, zm_memord_relaxed) != ZM_NULL)
+        return ZM_WSKIP_EBUSY;
+    zm_atomic_store(&I->next, ZM_NULL, zm_memord_relaxed);
+    if (!zm_atomic_compare_exchange_strong(&L->lock, &expected, (zm_ptr_t)I,
+                                           zm_memord_acq_rel, zm_memord_relaxed))
+        return ZM_WSKIP_EBUSY;
+    zm_atomic_store(&I->status, ZM_WAKE, zm_memord_release);
+    prof_enq(I);
+    prof_acquired(I);
+    return 0;
+}
+
+static inline void make_deadline(struct timespec *deadline, long timeout_ns) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout_ns / 1000000000L;
+    deadline->tv_nsec += timeout_ns % 1000000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/* Queue up, but give up at deadline. An abandoned node is left in the
+ * queue as SKIP; wake() passes over it, and the next wait on this lock
+ * by the same thread reactivates it in place. */
+static inline int timed_wait(struct zm_mcs *L, zm_mcs_qnode_t* I,
+                             const struct timespec *deadline) {
+    int wait = 0, status = ZM_WAIT;
+
+    enq(L, I, &wait);
+    if (wait && wait_status(L, I, deadline) != 0) {
+        /* deadline passed: abandon, unless the lock was handed over meanwhile */
+        if (zm_atomic_compare_exchange_strong(&I->status, &status, ZM_SKIP,
+                                              zm_memord_acq_rel, zm_memord_acquire)) {
+            prof_skipped(I);
+            return ZM_WSKIP_ETIMEDOUT;
+        }
+    }
+    prof_acquired(I);
+    return 0;
+}
+
+/* Hand the lock to a waiting node. Fails if the node skipped. */
+static inline int hand(zm_mcs_qnode_t *node) {
+    int status = ZM_WAIT;
+    if (!zm_atomic_compare_exchange_strong(&node->status, &status, ZM_WAKE,
+                                           zm_memord_seq_cst, zm_memord_acquire))
+        return 0;
+    if (zm_atomic_load(&WSKIP_NODE(node)->parked, zm_memord_seq_cst))
+        futex_wake(&node->status);
+    return 1;
+}
+
+/* Recycle a skipped node the lock has moved past. Fails if its owner
+ * reactivated it (SKIP -> WAIT) in the meantime. */
+static inline int retire(zm_mcs_qnode_t *node) {
+    int status = ZM_SKIP;
+    return zm_atomic_compare_exchange_strong(&node->status, &status, ZM_RECYCLE,
+                                             zm_memord_acq_rel, zm_memord_acquire);
+}
+
+/* Keep a skipped node that may be the tail from being reactivated or
+ * reused while the holder tries to close the queue behind it. */
+static inline int block(zm_mcs_qnode_t *node) {
+    int status = ZM_SKIP;
+    return zm_atomic_compare_exchange_strong(&node->status, &status, ZM_CHECK,
+                                             zm_memord_acq_rel, zm_memord_acquire);
+}
+
+/* Move the highest-priority waiter among the first ZM_WSKIP_PRIO_WINDOW
+ * right behind the holder, so the regular traversal in wake_ex() hands
+ * it the lock. Only the holder relinks nodes, and the tail is never
+ * moved because a late enqueuer may still be writing its next field.
+ * Bypassed nodes keep their order and state, so SKIP/RECYCLE handling
+ * is unchanged. After ZM_WSKIP_PRIO_MAX_BYPASS promotions in a row the
+ * queue head gets its turn regardless of priority. */
+static inline void promote(struct zm_mcs *L, zm_mcs_qnode_t *I) {
+    zm_mcs_qnode_t *first = (zm_mcs_qnode_t*)zm_atomic_load(&I->next, zm_memord_acquire);
+    zm_mcs_qnode_t *pred = first, *best = NULL, *best_pred = NULL;
+    int best_prio;
+
+    if ((zm_ptr_t)first == ZM_NULL)
+        return;
+    if (L->bypasses >= ZM_WSKIP_PRIO_MAX_BYPASS) {
+        L->bypasses = 0;
+        return;
+    }
+
+    best_prio = WSKIP_NODE(first)->prio;
+    for (int i = 1; i < ZM_WSKIP_PRIO_WINDOW; i++) {
+        zm_mcs_qnode_t *cur = (zm_mcs_qnode_t*)zm_atomic_load(&pred->next, zm_memord_acquire);
+        if ((zm_ptr_t)cur == ZM_NULL ||
+            zm_atomic_load(&cur->next, zm_memord_acquire) == ZM_NULL)
+            break;
+        if (WSKIP_NODE(cur)->prio > best_prio &&
+            zm_atomic_load(&cur->status, zm_memord_acquire) == ZM_WAIT) {
+            best = cur;
+            best_pred = pred;
+            best_prio = WSKIP_NODE(cur)->prio;
+        }
+        pred = cur;
+    }
+
+    if (best == NULL) {
+        L->bypasses = 0;
+        return;
+    }
+    zm_atomic_store(&best_pred->next, zm_atomic_load(&best->next, zm_memord_acquire),
+                    zm_memord_release);
+    zm_atomic_store(&best->next, (zm_ptr_t)first, zm_memord_release);
+    zm_atomic_store(&I->next, (zm_ptr_t)best, zm_memord_release);
+    L->bypasses++;
+}
+
+static void requeue(struct zm_mcs *L, zm_mcs_qnode_t *node);
+
+/* Pass the lock on from cur_node, which is either the releasing holder
+ * I or, with I == NULL, a skipped node the lock fell to in requeue().
+ *
+ * Skipped nodes are stepped over with plain loads: the handoff itself
+ * costs one CAS on the node that gets the lock, however many nodes it
+ * passes. The passed nodes are recycled afterwards, off the critical
+ * path, by walking the chain from the first one to the new holder. An
+ * owner may reactivate its node (SKIP -> WAIT) after the holder read it
+ * as skipped; such a node fails to retire and is queued again at the
+ * tail. Only a node that may be the tail is held in CHECK while the
+ * queue is being closed. */
+static int pass_on(struct zm_mcs *L, zm_mcs_qnode_t *I, zm_mcs_qnode_t *cur_node,
+                   void (*release_cb)(void *), void *arg) {
+    zm_mcs_qnode_t *first = (I == NULL) ? cur_node : NULL; /* first node passed */
+    zm_mcs_qnode_t *stop;  /* end of the passed chain */
+    zm_mcs_qnode_t *next;
+    zm_ulong_t passed = 0;
+    int released = 0;
+
+    for (;;) {
+        next = (zm_mcs_qnode_t*)zm_atomic_load(&cur_node->next, zm_memord_acquire);
+        if ((zm_ptr_t)next == ZM_NULL) {
+            zm_mcs_qnode_t *tmp = cur_node;
+            if (cur_node != I && !block(cur_node)) {
+                /* reactivated by its owner after we passed it */
+                if (hand(cur_node)) {
+                    stop = cur_node;
+                    break;
+                }
+                continue;
+            }
+            if (release_cb && !released) {
+                release_cb(arg);
+                released = 1;
+            }
+            if(zm_atomic_compare_exchange_strong(&L->lock,
+                                                 (zm_ptr_t*)&tmp,
+                                                 ZM_NULL,
+                                                 zm_memord_acq_rel,
+                                                 zm_memord_acquire)) {
+                if (cur_node != I)
+                    zm_atomic_store(&cur_node->status, ZM_RECYCLE, zm_memord_release);
+                stop = cur_node;
+                break;
+            }
+            while((zm_ptr_t)(next = (zm_mcs_qnode_t*)zm_atomic_load(&cur_node->next, zm_memord_acquire)) == ZM_NULL)
+                ZM_WSKIP_RELAX(); /* SPIN */
+            /* no longer the tail: an ordinary passed node again */
+            if (cur_node != I)
+                zm_atomic_store(&cur_node->status, ZM_SKIP, zm_memord_release);
+        }
+        if (zm_atomic_load(&next->status, zm_memord_acquire) != ZM_SKIP && hand(next)) {
+            stop = next;
+            break;
+        }
+        if (first == NULL)
+            first = next;
+        cur_node = next;
+        passed++;
+    }
+    if (I != NULL) {
+        prof_handoff(I, passed);
+        zm_atomic_store(&I->next, NULL, zm_memord_release);
+    }
+
+    /* a link is read before its node is recycled, since the owner may
+     * then reuse it at once */
+    while (first != NULL && first != stop) {
+        next = (zm_mcs_qnode_t*)zm_atomic_load(&first->next, zm_memord_acquire);
+        if (!retire(first))
+            requeue(L, first);
+        first = next;
+    }
+    return 0;
+}
+
+/* Queue a passed node again on behalf of its owner, who reactivated it
+ * and is waiting for the lock. */
+static void requeue(struct zm_mcs *L, zm_mcs_qnode_t *node) {
+    zm_mcs_qnode_t *pred;
+
+    zm_atomic_store(&node->next, ZM_NULL, zm_memord_release);
+    pred = (zm_mcs_qnode_t*)zm_atomic_exchange_ptr(&L->lock, (zm_ptr_t)node, zm_memord_acq_rel);
+    if ((zm_ptr_t)pred != ZM_NULL) {
+        zm_atomic_store(&pred->next, (zm_ptr_t)node, zm_memord_release);
+        return;
+    }
+    /* the queue was empty, so the node now holds the lock; if its owner
+     * gave up again in the meantime, pass the lock on */
+    if (!hand(node))
+        pass_on(L, NULL, node, NULL, NULL);
+}
+
+/* Release the lock. If the queue turns out to be empty, release_cb is
+ * called while the lock is still held, right before it is dropped. */
+static inline int wake_ex(struct zm_mcs *L, zm_mcs_qnode_t *I,
+                          void (*release_cb)(void *), void *arg) {
 
     int status = ZM_WAKE;
     if(!zm_atomic_compare_exchange_strong(&I->status,
@@ -119,58 +755,26 @@ static inline int wake(struct zm_mcs *L, zm_mcs_qnode_t *I) {
                                          zm_memord_acq_rel,
                                          zm_memord_acquire))
         return 0;
+    prof_release(I);
 
-    zm_mcs_qnode_t *cur_node = I;
-    zm_mcs_qnode_t *next = (zm_mcs_qnode_t*)zm_atomic_load(&cur_node->next, zm_memord_acquire);
-    zm_mcs_qnode_t *pred = NULL;
-    /* traverse queue until end or encountering a node that wasn't skipped */
-    while ((zm_ptr_t)next != ZM_NULL) {
-        int status = ZM_WAIT;
-        if(zm_atomic_compare_exchange_strong(&next->status,
-                                         &status,
-                                         ZM_WAKE,
-                                         zm_memord_acq_rel,
-                                         zm_memord_acquire))
-            break;
-        zm_atomic_store(&next->status, ZM_CHECK, zm_memord_release);
-        /* modify next for reverse traversal later */
-        zm_atomic_store(&cur_node->next, pred, zm_memord_release);
-        pred = cur_node;
-        cur_node = next;
-        next = (zm_mcs_qnode_t*)zm_atomic_load(&next->next, zm_memord_acquire);
-    }
-    /* reverse traversal for recycling */
-    zm_atomic_store(&cur_node->status, ZM_RECYCLE, zm_memord_release);
-    zm_mcs_qnode_t *rev = pred;
-    while((zm_ptr_t)rev != ZM_NULL) {
-        zm_atomic_store(&rev->status, ZM_RECYCLE, zm_memord_release);
-        rev = (zm_mcs_qnode_t*)zm_atomic_load(&rev->next, zm_memord_acquire);
-    }
-
-    if ((zm_ptr_t)next == ZM_NULL) {
-        zm_mcs_qnode_t *tmp = cur_node;
-        if(zm_atomic_compare_exchange_strong(&L->lock,
-                                             (zm_ptr_t*)&tmp,
-                                             ZM_NULL,
-                                             zm_memord_acq_rel,
-                                             zm_memord_acquire))
-            return 0;
-        while(zm_atomic_load(&cur_node->next, zm_memord_acquire) == ZM_NULL)
-            ; /* SPIN */
-        zm_atomic_store(&((zm_mcs_qnode_t*)zm_atomic_load(&cur_node->next, zm_memord_acquire))->status, ZM_WAKE, zm_memord_release);
-    }
-    zm_atomic_store(&I->next, NULL, zm_memord_release);
+    if (zm_atomic_load(&L->use_prio, zm_memord_relaxed))
+        promote(L, I);
 
-    return 0;
+    return pass_on(L, I, I, release_cb, arg);
+}
+
+static inline int wake(struct zm_mcs *L, zm_mcs_qnode_t *I) {
+    return wake_ex(L, I, NULL, NULL);
 }
 
 static inline int skip(zm_mcs_qnode_t *I) {
     int status = ZM_WAIT;
-    zm_atomic_compare_exchange_strong(&I->status,
-                                      &status,
-                                      ZM_SKIP,
-                                      zm_memord_acq_rel,
-                                      zm_memord_acquire);
+    if (zm_atomic_compare_exchange_strong(&I->status,
+                                          &status,
+                                          ZM_SKIP,
+                                          zm_memord_acq_rel,
+                                          zm_memord_acquire))
+        prof_skipped(I);
     return 0;
 }
 
@@ -178,21 +782,208 @@ static inline int nowaiters(struct zm_mcs *L, zm_mcs_qnode_t *I) {
     return (zm_atomic_load(&I->next, zm_memord_acquire) == ZM_NULL);
 }
 
+/* Adaptive mode (ZM_WSKIP_ADAPTIVE=1): a test-and-test-and-set word in
+ * front of the queue. While the lock is deflated, acquirers take the
+ * word directly and never touch the queue. A thread that cannot get it
+ * within ZM_WSKIP_TTAS_SPINS polls inflates the lock; from then on
+ * acquirers queue up and only the queue head competes for the word, so
+ * the word remains the mutex in both modes and a thread that missed the
+ * inflation is still excluded. After ZM_WSKIP_DEFLATE_QUIET releases in
+ * a row with nobody queued behind the holder, the lock deflates.
+ * A node records whether it set the word, and only that node clears it
+ * on release. zm_wskip_enq() is refused in this mode: a node it queues
+ * would hold the lock without the word, so a fast acquirer could take
+ * the word and enter alongside it. */
+static inline int ttas_try(struct zm_mcs *L) {
+    int expected = 0;
+    return zm_atomic_load(&L->ttas, zm_memord_relaxed) == 0 &&
+        zm_atomic_compare_exchange_strong(&L->ttas, &expected, 1,
+                                          zm_memord_acquire, zm_memord_relaxed);
+}
+
+/* Used by the queue head, which at most waits for one fast-path holder.
+ * Returns ZM_WSKIP_ETIMEDOUT if deadline (optional) passes first. */
+static inline int ttas_acquire(struct zm_mcs *L, zm_mcs_qnode_t *I,
+                               const struct timespec *deadline) {
+    unsigned spins = 0, polls = 0;
+    while (!ttas_try(L)) {
+        if (deadline && ++polls % ZM_WSKIP_CLOCK_POLLS == 0 && remaining_ns(deadline) == 0)
+            return ZM_WSKIP_ETIMEDOUT;
+        spin_once(L->wait_mode, &spins);
+    }
+    WSKIP_NODE(I)->ttas_held = 1;
+    return 0;
+}
+
+/* Take the word without queueing. Only a node that is not queued (e.g.
+ * left as SKIP by a timed wait) may bypass the queue. */
+static inline int fast_acquire(struct zm_mcs *L, zm_mcs_qnode_t *I) {
+    if (zm_atomic_load(&L->inflated, zm_memord_relaxed) ||
+        zm_atomic_load(&I->status, zm_memord_acquire) != ZM_RECYCLE)
+        return 0;
+    prof_enq(I);
+    for (int i = 0; i < ZM_WSKIP_TTAS_SPINS; i++) {
+        if (ttas_try(L)) {
+            WSKIP_NODE(I)->fast = 1;
+            WSKIP_NODE(I)->ttas_held = 1;
+            prof_acquired(I);
+            return 1;
+        }
+        if (zm_atomic_load(&L->inflated, zm_memord_relaxed))
+            return 0;
+        ZM_WSKIP_RELAX();
+    }
+    zm_atomic_store(&L->inflated, 1, zm_memord_relaxed);
+    return 0;
+}
+
+static inline int adaptive_wait(struct zm_mcs *L, zm_mcs_qnode_t *I) {
+    if (fast_acquire(L, I))
+        return 0;
+    zm_wait(L, I);
+    return ttas_acquire(L, I, NULL);
+}
+
+static inline int adaptive_wake(struct zm_mcs *L, zm_mcs_qnode_t *I) {
+    if (WSKIP_NODE(I)->fast) {
+        WSKIP_NODE(I)->fast = 0;
+        WSKIP_NODE(I)->ttas_held = 0;
+        prof_release(I);
+        zm_atomic_store(&L->ttas, 0, zm_memord_release);
+        return 0;
+    }
+    if (!nowaiters(L, I))
+        L->quiet = 0;
+    else if (++L->quiet >= ZM_WSKIP_DEFLATE_QUIET) {
+        L->quiet = 0;
+        zm_atomic_store(&L->inflated, 0, zm_memord_relaxed);
+    }
+    if (WSKIP_NODE(I)->ttas_held) {
+        WSKIP_NODE(I)->ttas_held = 0;
+        zm_atomic_store(&L->ttas, 0, zm_memord_release);
+    }
+    return wake(L, I);
+}
+
+static inline int adaptive_trywait(struct zm_mcs *L, zm_mcs_qnode_t *I) {
+    if (zm_atomic_load(&I->status, zm_memord_acquire) != ZM_RECYCLE ||
+        zm_atomic_load(&L->lock, zm_memord_relaxed) != ZM_NULL ||
+        !ttas_try(L))
+        return ZM_WSKIP_EBUSY;
+    WSKIP_NODE(I)->fast = 1;
+    WSKIP_NODE(I)->ttas_held = 1;
+    prof_enq(I);
+    prof_acquired(I);
+    return 0;
+}
+
+/* Reader-writer use: readers take the lock only long enough to register
+ * in L->readers and then release it, so a run of readers in the queue is
+ * granted back to back and they proceed together. Every exclusive
+ * acquire waits here, while holding the lock, for active readers to
+ * leave; readers queued behind a waiting writer stay queued, so writers
+ * are not starved. Returns ZM_WSKIP_ETIMEDOUT if deadline (optional)
+ * passes first. */
+static inline int drain_readers(struct zm_mcs *L, const struct timespec *deadline) {
+    unsigned spins = 0, polls = 0;
+    while (zm_atomic_load(&L->readers, zm_memord_acquire) != 0) {
+        if (deadline && ++polls % ZM_WSKIP_CLOCK_POLLS == 0 && remaining_ns(deadline) == 0)
+            return ZM_WSKIP_ETIMEDOUT;
+        spin_once(L->wait_mode, &spins);
+    }
+    return 0;
+}
+
+static inline int acquire(struct zm_mcs *L, zm_mcs_qnode_t *I) {
+    if (L->adaptive)
+        adaptive_wait(L, I);
+    else
+        zm_wait(L, I);
+    return drain_readers(L, NULL);
+}
+
 int wskip_wait(struct zm_mcs *L, zm_mcs_qnode_t** I) {
-    if (zm_unlikely(tid == -1)) {
-        check_affinity(L->topo);
-        tid = get_hwthread_id(L->topo);
+    struct zm_wskip_qnode *node = get_node(L);
+    node->prio = 0;
+    *I = &node->mcs;
+    return acquire(L, *I);
+}
+
+int wskip_wait_prio(struct zm_mcs *L, zm_mcs_qnode_t** I, int prio) {
+    struct zm_wskip_qnode *node = get_node(L);
+    if (prio > 0 && !zm_atomic_load(&L->use_prio, zm_memord_relaxed))
+        zm_atomic_store(&L->use_prio, 1, zm_memord_relaxed);
+    node->prio = prio;
+    *I = &node->mcs;
+    return acquire(L, *I);
+}
+
+int wskip_wake(struct zm_mcs *L, zm_mcs_qnode_t *I);
+
+int wskip_trywait(struct zm_mcs *L, zm_mcs_qnode_t** I) {
+    int ret;
+    *I = &get_node(L)->mcs;
+    ret = L->adaptive ? adaptive_trywait(L, *I) : try_wait(L, *I);
+    if (ret == 0 && zm_atomic_load(&L->readers, zm_memord_acquire) != 0) {
+        wskip_wake(L, *I);
+        return ZM_WSKIP_EBUSY;
+    }
+    return ret;
+}
+
+int wskip_timedwait(struct zm_mcs *L, zm_mcs_qnode_t** I, long timeout_ns) {
+    struct timespec deadline;
+    int ret = 0;
+    *I = &get_node(L)->mcs;
+    make_deadline(&deadline, timeout_ns);
+    if (!L->adaptive || !fast_acquire(L, *I)) {
+        ret = timed_wait(L, *I, &deadline);
+        if (ret != 0)
+            return ret;
+        if (L->adaptive && ttas_acquire(L, *I, &deadline) != 0) {
+            /* queue head, but a fast-path holder outlasted the deadline */
+            wake(L, *I);
+            return ZM_WSKIP_ETIMEDOUT;
+        }
     }
-    *I= &L->local_nodes[tid];
-    return zm_wait(L, *I);
+    if (drain_readers(L, &deadline) != 0) {
+        wskip_wake(L, *I);
+        return ZM_WSKIP_ETIMEDOUT;
+    }
+    return 0;
+}
+
+/* Shared acquire: any waiter kind queued ahead is served first, and a
+ * writer that already holds the lock blocks new readers until it wakes. */
+int wskip_rdwait(struct zm_mcs *L, zm_mcs_qnode_t** I) {
+    struct zm_wskip_qnode *node = get_node(L);
+    node->prio = 0;
+    *I = &node->mcs;
+    if (L->adaptive)
+        adaptive_wait(L, *I);
+    else
+        zm_wait(L, *I);
+    zm_atomic_fetch_add(&L->readers, 1, zm_memord_acq_rel);
+    wskip_wake(L, *I);
+    return 0;
+}
+
+int wskip_rdwake(struct zm_mcs *L, zm_mcs_qnode_t *I) {
+    (void)I;
+    zm_atomic_fetch_sub(&L->readers, 1, zm_memord_release);
+    return 0;
 }
 
 int wskip_enq(struct zm_mcs *L, zm_mcs_qnode_t *I) {
     int wait; /* unused */
+    if (L->adaptive)
+        return ZM_WSKIP_EINVAL; /* see the adaptive mode notes above */
     return enq(L, I, &wait);
 }
 
 int wskip_wake(struct zm_mcs *L, zm_mcs_qnode_t *I) {
+    if (L->adaptive)
+        return adaptive_wake(L, I);
     return wake(L, I);
 }
 
@@ -201,13 +992,35 @@ int wskip_skip(zm_mcs_qnode_t *I) {
 }
 
 int wskip_nowaiters(struct zm_mcs *L, zm_mcs_qnode_t *I) {
+    if (L->adaptive && WSKIP_NODE(I)->fast)
+        return zm_atomic_load(&L->lock, zm_memord_acquire) == ZM_NULL;
     return nowaiters(L, I);
 }
 
 static inline int free_wskip(struct zm_mcs *L)
 {
-    free(L->local_nodes);
-    hwloc_topology_destroy(L->topo);
+    struct zm_wskip_qnode *node = (struct zm_wskip_qnode *)
+        zm_atomic_load(&L->nodes, zm_memord_acquire);
+    struct wskip_tls *t = tls_nodes;
+
+    prof_dump(L);
+    /* the caller's own entry goes now; other threads prune theirs the
+     * next time their cache grows, or when they exit */
+    if (tls_last_id == L->id) {
+        tls_last_id = 0;
+        tls_last_node = NULL;
+    }
+    if (t != NULL && t->entries[tls_slot(t, L->id)].id == L->id) {
+        struct zm_wskip_qnode *mine = t->entries[tls_slot(t, L->id)].node;
+        tls_remove(t, L->id);
+        node_release(mine, WSKIP_THREAD_GONE);
+    }
+    while (node != NULL) {
+        struct zm_wskip_qnode *next = node->reg_next;
+        node_release(node, WSKIP_LOCK_GONE);
+        node = next;
+    }
+    free(L);
     return 0;
 }
 
@@ -227,6 +1040,26 @@ int zm_wskip_wait(zm_mcs_t L, zm_mcs_qnode_t** I) {
     return wskip_wait((struct zm_mcs*)(void *)L, I);
 }
 
+int zm_wskip_wait_prio(zm_mcs_t L, zm_mcs_qnode_t** I, int prio) {
+    return wskip_wait_prio((struct zm_mcs*)(void *)L, I, prio);
+}
+
+int zm_wskip_rdwait(zm_mcs_t L, zm_mcs_qnode_t** I) {
+    return wskip_rdwait((struct zm_mcs*)(void *)L, I);
+}
+
+int zm_wskip_rdwake(zm_mcs_t L, zm_mcs_qnode_t *I) {
+    return wskip_rdwake((struct zm_mcs*)(void *)L, I);
+}
+
+int zm_wskip_trywait(zm_mcs_t L, zm_mcs_qnode_t** I) {
+    return wskip_trywait((struct zm_mcs*)(void *)L, I);
+}
+
+int zm_wskip_timedwait(zm_mcs_t L, zm_mcs_qnode_t** I, long timeout_ns) {
+    return wskip_timedwait((struct zm_mcs*)(void *)L, I, timeout_ns);
+}
+
 int zm_wskip_enq(zm_mcs_t L, zm_mcs_qnode_t* I) {
     return wskip_enq((struct zm_mcs*)(void *)L, I);
 }
@@ -243,3 +1076,175 @@ int zm_wskip_nowaiters(zm_mcs_t L, zm_mcs_qnode_t *I) {
     return wskip_nowaiters((struct zm_mcs*)(void *)L, I);
 }
 
+
+/* NUMA cohort lock: a wskip queue per socket in front of a top-level
+ * ticket lock. The ticket lock is thread-oblivious, so it can be
+ * released by a different thread of the same socket than the one that
+ * acquired it. global_held and passes belong to the socket and are only
+ * touched by the current holder of that socket's queue. */
+
+#define ZM_WSKIP_COHORT_PASSES 64
+
+struct zm_cohort_socket {
+    struct zm_mcs *L ZM_ALLIGN_TO_CACHELINE;
+    int global_held;
+    int passes;
+};
+
+struct zm_cohort {
+    zm_atomic_uint_t ticket ZM_ALLIGN_TO_CACHELINE;
+    zm_atomic_uint_t grant ZM_ALLIGN_TO_CACHELINE;
+    int nsockets;
+    int max_passes;
+    int ncpus;
+    int *cpu_socket; /* OS cpu index -> socket index */
+    struct zm_cohort_socket *sockets;
+};
+
+/* At most one thread per socket waits here, so the ticket lock is only
+ * contended by socket leaders. In hybrid mode they yield the CPU once the
+ * spin budget is exhausted rather than parking. */
+static inline void global_acquire(struct zm_cohort *C, int wait_mode) {
+    unsigned ticket = zm_atomic_fetch_add(&C->ticket, 1, zm_memord_relaxed);
+    unsigned spins = 0;
+    while (zm_atomic_load(&C->grant, zm_memord_acquire) != ticket)
+        spin_once(wait_mode, &spins);
+}
+
+static inline void global_release(struct zm_cohort *C) {
+    unsigned grant = zm_atomic_load(&C->grant, zm_memord_relaxed);
+    zm_atomic_store(&C->grant, grant + 1, zm_memord_release);
+}
+
+static void cohort_release_cb(void *arg) {
+    struct zm_cohort *C = (struct zm_cohort *)((void **)arg)[0];
+    struct zm_cohort_socket *S = (struct zm_cohort_socket *)((void **)arg)[1];
+    S->global_held = 0;
+    global_release(C);
+}
+
+static inline struct zm_cohort_socket *current_socket(struct zm_cohort *C) {
+#if defined(__linux__)
+    int cpu = sched_getcpu();
+#else
+    int cpu = 0;
+#endif
+    if (cpu < 0 || cpu >= C->ncpus)
+        return &C->sockets[0];
+    return &C->sockets[C->cpu_socket[cpu]];
+}
+
+/* A thread may migrate while holding the lock; release through the
+ * socket whose queue its node belongs to. */
+static inline struct zm_cohort_socket *node_socket(struct zm_cohort *C, zm_mcs_qnode_t *I) {
+    for (int i = 0; i < C->nsockets; i++)
+        if (C->sockets[i].L->id == WSKIP_NODE(I)->lock_id)
+            return &C->sockets[i];
+    return &C->sockets[0];
+}
+
+static void* new_cohort() {
+    struct zm_cohort *C;
+    hwloc_topology_t topo;
+    const char *env = getenv("ZM_WSKIP_COHORT_PASSES");
+
+    posix_memalign((void **) &C, ZM_CACHELINE_SIZE, sizeof(struct zm_cohort));
+    zm_atomic_store(&C->ticket, 0, zm_memord_relaxed);
+    zm_atomic_store(&C->grant, 0, zm_memord_release);
+    C->max_passes = env ? atoi(env) : ZM_WSKIP_COHORT_PASSES;
+
+    hwloc_topology_init(&topo);
+    hwloc_topology_load(topo);
+    C->nsockets = hwloc_get_nbobjs_by_type(topo, HWLOC_OBJ_PACKAGE);
+    if (C->nsockets < 1)
+        C->nsockets = 1;
+    C->ncpus = hwloc_bitmap_last(hwloc_topology_get_topology_cpuset(topo)) + 1;
+    if (C->ncpus < 1)
+        C->ncpus = 1;
+    C->cpu_socket = calloc(C->ncpus, sizeof(int));
+    for (int s = 0; s < C->nsockets; s++) {
+        hwloc_obj_t pkg = hwloc_get_obj_by_type(topo, HWLOC_OBJ_PACKAGE, s);
+        unsigned cpu;
+        if (pkg == NULL)
+            continue;
+        hwloc_bitmap_foreach_begin(cpu, pkg->cpuset)
+            if ((int)cpu < C->ncpus)
+                C->cpu_socket[cpu] = s;
+        hwloc_bitmap_foreach_end();
+    }
+    hwloc_topology_destroy(topo);
+
+    posix_memalign((void **) &C->sockets, ZM_CACHELINE_SIZE,
+                   sizeof(struct zm_cohort_socket) * C->nsockets);
+    for (int s = 0; s < C->nsockets; s++) {
+        C->sockets[s].L = new_wskip();
+        C->sockets[s].L->adaptive = 0; /* the cohort drives the queues itself */
+        C->sockets[s].global_held = 0;
+        C->sockets[s].passes = 0;
+    }
+    return C;
+}
+
+static inline int free_cohort(struct zm_cohort *C) {
+    for (int s = 0; s < C->nsockets; s++)
+        free_wskip(C->sockets[s].L);
+    free(C->sockets);
+    free(C->cpu_socket);
+    free(C);
+    return 0;
+}
+
+static inline int cohort_wait(struct zm_cohort *C, zm_mcs_qnode_t **I) {
+    struct zm_cohort_socket *S = current_socket(C);
+    wskip_wait(S->L, I);
+    if (!S->global_held) {
+        global_acquire(C, S->L->wait_mode);
+        S->global_held = 1;
+        S->passes = 0;
+    }
+    return 0;
+}
+
+static inline int cohort_wake(struct zm_cohort *C, zm_mcs_qnode_t *I) {
+    struct zm_cohort_socket *S = node_socket(C, I);
+    if (S->passes < C->max_passes && !nowaiters(S->L, I)) {
+        /* keep the top-level lock inside the socket; if every local
+         * waiter turns out to have skipped, the callback drops it */
+        void *arg[2] = {C, S};
+        S->passes++;
+        return wake_ex(S->L, I, cohort_release_cb, arg);
+    }
+    S->global_held = 0;
+    global_release(C);
+    return wake(S->L, I);
+}
+
+static inline int cohort_nowaiters(struct zm_cohort *C, zm_mcs_qnode_t *I) {
+    struct zm_cohort_socket *S = node_socket(C, I);
+    unsigned ticket = zm_atomic_load(&C->ticket, zm_memord_acquire);
+    unsigned grant = zm_atomic_load(&C->grant, zm_memord_acquire);
+    return nowaiters(S->L, I) && (ticket - grant <= 1);
+}
+
+int zm_wskip_cohort_init(zm_mcs_t *handle) {
+    void *p = new_cohort();
+    *handle = (zm_mcs_t) p;
+    return 0;
+}
+
+int zm_wskip_cohort_destroy(zm_mcs_t *C) {
+    free_cohort((struct zm_cohort*)(*C));
+    return 0;
+}
+
+int zm_wskip_cohort_wait(zm_mcs_t C, zm_mcs_qnode_t** I) {
+    return cohort_wait((struct zm_cohort*)(void *)C, I);
+}
+
+int zm_wskip_cohort_wake(zm_mcs_t C, zm_mcs_qnode_t *I) {
+    return cohort_wake((struct zm_cohort*)(void *)C, I);
+}
+
+int zm_wskip_cohort_nowaiters(zm_mcs_t C, zm_mcs_qnode_t *I) {
+    return cohort_nowaiters((struct zm_cohort*)(void *)C, I);
+}
@@ -7,13 +7,15 @@ prefixdir = ${prefix}
 
 zm_headers = \
 	include/common/zm_common.h \
+	include/common/zm_tsc.h \
 	include/queue/zm_queue_types.h \
 	include/queue/zm_glqueue.h \
 	include/queue/zm_swpqueue.h \
 	include/queue/zm_faqueue.h \
 	include/queue/zm_mpbqueue.h \
 	include/queue/zm_msqueue.h \
-	include/queue/zm_multqueue.h
+	include/queue/zm_multqueue.h \
+	include/queue/zm_elimqueue.h
 
 
 if ZM_HAVE_HWLOC
@@ -0,0 +1,30 @@
+/* -*- Mode: C; c-basic-offset:4 ; indent-tabs-mode:nil ; -*- */
+/*
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef _ZM_TSC_H
+#define _ZM_TSC_H
+#include <stdint.h>
+#include <time.h>
+
+/* Cycle counter shared by the izem lock profiler and benchmarks: the
+ * x86 TSC, the ARM generic timer, else CLOCK_MONOTONIC nanoseconds.
+ * The read is not ordered against surrounding instructions. */
+static inline uint64_t zm_tsc(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned hi, lo;
+    __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)lo) | (((uint64_t)hi) << 32);
+#elif defined(__aarch64__)
+    uint64_t t;
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+#endif /* _ZM_TSC_H */
@@ -0,0 +1,49 @@
+/* -*- Mode: C; c-basic-offset:4 ; indent-tabs-mode:nil ; -*- */
+/*
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef _ZM_WSKIP_H
+#define _ZM_WSKIP_H
+#include <stdlib.h>
+#include <stdio.h>
+#include "lock/zm_lock_types.h"
+
+/* return codes of the conditional acquire routines */
+#define ZM_WSKIP_EBUSY     1 /* trywait: lock held or contended */
+#define ZM_WSKIP_ETIMEDOUT 2 /* timedwait: gave up, node left as SKIP */
+#define ZM_WSKIP_EINVAL    3 /* enq: not supported on an adaptive lock */
+
+int zm_wskip_init(zm_mcs_t *);
+/* In a build with -DZM_WSKIP_PROFILE, also prints per-thread wait, hold,
+ * skip and handoff-distance histograms (see zm_wskip.c). */
+int zm_wskip_destroy(zm_mcs_t *);
+int zm_wskip_wait(zm_mcs_t, zm_mcs_qnode_t**);
+/* Like zm_wskip_wait, but on release the holder hands the lock to the
+ * highest priority waiter within a bounded window (0 is the default
+ * class; larger values go first). */
+int zm_wskip_wait_prio(zm_mcs_t, zm_mcs_qnode_t**, int prio);
+/* Shared (reader) acquire and release. Readers run concurrently; every
+ * other acquire routine is exclusive and waits for active readers. */
+int zm_wskip_rdwait(zm_mcs_t, zm_mcs_qnode_t**);
+int zm_wskip_rdwake(zm_mcs_t, zm_mcs_qnode_t*);
+int zm_wskip_trywait(zm_mcs_t, zm_mcs_qnode_t**);
+int zm_wskip_timedwait(zm_mcs_t, zm_mcs_qnode_t**, long timeout_ns);
+/* Queue a node without waiting for it. Fails with ZM_WSKIP_EINVAL on a
+ * lock in adaptive mode (ZM_WSKIP_ADAPTIVE=1). */
+int zm_wskip_enq(zm_mcs_t, zm_mcs_qnode_t*);
+int zm_wskip_wake(zm_mcs_t, zm_mcs_qnode_t*);
+int zm_wskip_skip(zm_mcs_qnode_t*);
+int zm_wskip_nowaiters(zm_mcs_t, zm_mcs_qnode_t*);
+
+/* NUMA cohort variant: one wait-skip queue per socket plus a top-level
+ * lock. Ownership is passed within a socket at most
+ * ZM_WSKIP_COHORT_PASSES times (env, default 64) before the top-level
+ * lock is released to other sockets. */
+int zm_wskip_cohort_init(zm_mcs_t *);
+int zm_wskip_cohort_destroy(zm_mcs_t *);
+int zm_wskip_cohort_wait(zm_mcs_t, zm_mcs_qnode_t**);
+int zm_wskip_cohort_wake(zm_mcs_t, zm_mcs_qnode_t*);
+int zm_wskip_cohort_nowaiters(zm_mcs_t, zm_mcs_qnode_t*);
+
+#endif /* _ZM_WSKIP_H */
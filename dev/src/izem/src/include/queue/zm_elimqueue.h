@@ -0,0 +1,25 @@
+/* -*- Mode: C; c-basic-offset:4 ; indent-tabs-mode:nil ; -*- */
+/*
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef _ZM_ELIMQUEUE_H
+#define _ZM_ELIMQUEUE_H
+#include <stdlib.h>
+#include <stdio.h>
+#include "queue/zm_queue_types.h"
+
+/* elimqueue: elimination-backoff layer in front of a glqueue or msqueue
+ * (the backend argument of zm_elimqueue_init; any other value is msqueue).
+ * A dequeuer that finds the queue empty parks briefly in a slot of the
+ * elimination array; an enqueuer that finds the queue empty hands its
+ * item to a parked dequeuer instead of touching head/tail. Exchanges only
+ * happen while the backend is empty, so per-producer FIFO order holds.
+ * The number of active slots adapts to the observed collision rate. */
+
+int zm_elimqueue_init(zm_elimqueue_t *, int backend);
+int zm_elimqueue_enqueue(zm_elimqueue_t* q, void *data);
+int zm_elimqueue_dequeue(zm_elimqueue_t* q, void **data);
+int zm_elimqueue_destroy(zm_elimqueue_t *);
+
+#endif /* _ZM_ELIMQUEUE_H */
@@ -25,8 +25,20 @@ struct zm_glqueue {
 };
 
 /* swpqueue */
-typedef struct zm_msqueue zm_swpqueue_t;
-typedef struct zm_msqnode zm_swpqnode_t;
+typedef struct zm_swpqueue zm_swpqueue_t;
+typedef struct zm_swpqnode zm_swpqnode_t;
+
+struct zm_swpqnode {
+    void *data ZM_ALLIGN_TO_CACHELINE;
+    zm_atomic_ptr_t next;
+};
+
+/* head is only touched by the single consumer; tail is the swap point
+ * shared by all producers */
+struct zm_swpqueue {
+    zm_atomic_ptr_t head ZM_ALLIGN_TO_CACHELINE;
+    zm_atomic_ptr_t tail ZM_ALLIGN_TO_CACHELINE;
+};
 
 /* msqueue */
 typedef struct zm_msqueue zm_msqueue_t;
@@ -93,6 +105,27 @@ struct zm_multqueue {
     zm_glqueue_t* queues;
 };
 
+/* elimqueue: elimination array in front of a glqueue or msqueue */
+#define ZM_ELIM_MAX_SLOTS       16
+
+typedef struct zm_elimslot  zm_elimslot_t;
+typedef struct zm_elimqueue zm_elimqueue_t;
+
+struct zm_elimslot {
+    zm_atomic_int_t state ZM_ALLIGN_TO_CACHELINE;
+    void *data;
+};
+
+struct zm_elimqueue {
+    int backend; /* ZM_GLQUEUE_IF or ZM_MSQUEUE_IF */
+    union {
+        zm_glqueue_t glqueue;
+        zm_msqueue_t msqueue;
+    } q;
+    zm_atomic_int_t width ZM_ALLIGN_TO_CACHELINE; /* active slots */
+    zm_elimslot_t *slots;
+};
+
 /* Common structure to allow runtime selection */
 
 typedef union zm_queue {
@@ -102,6 +135,7 @@ typedef union zm_queue {
     zm_faqueue_t  faqueue;
     zm_mpbqueue_t mpbqueue;
     zm_multqueue_t multqueue;
+    zm_elimqueue_t elimqueue;
 } zm_queue_t;
 
 
@@ -0,0 +1,23 @@
+/* -*- Mode: C; c-basic-offset:4 ; indent-tabs-mode:nil ; -*- */
+/*
+ * See COPYRIGHT in top-level directory.
+ */
+
+#ifndef _ZM_SWPQUEUE_H
+#define _ZM_SWPQUEUE_H
+#include <stdlib.h>
+#include <stdio.h>
+#include "queue/zm_queue_types.h"
+
+/* swpqueue: multi-producer single-consumer queue. Enqueue swaps itself
+ * into the tail (MCS-style) and then links the predecessor, so it is
+ * wait-free. Dequeue must only be called by the queue owner. */
+
+int zm_swpqueue_init(zm_swpqueue_t *);
+int zm_swpqueue_enqueue(zm_swpqueue_t* q, void *data);
+int zm_swpqueue_enqueue_bulk(zm_swpqueue_t* q, void **data, int n);
+int zm_swpqueue_dequeue(zm_swpqueue_t* q, void **data);
+int zm_swpqueue_dequeue_bulk(zm_swpqueue_t* q, void **data, int max);
+int zm_swpqueue_isempty(zm_swpqueue_t* q);
+
+#endif /* _ZM_SWPQUEUE_H */
@@ -10,5 +10,6 @@ zm_sources += \
 	queue/zm_faqueue.c \
 	queue/zm_mpbqueue.c \
 	queue/zm_msqueue.c \
-	queue/zm_multqueue.c
+	queue/zm_multqueue.c \
+	queue/zm_elimqueue.c
 
@@ -0,0 +1,193 @@
+/* -*- Mode: C; c-basic-offset:4 ; indent-tabs-mode:nil ; -*- */
+/*
+ * See COPYRIGHT in top-level directory.
+ */
+
+#include <stdlib.h>
+#include "queue/zm_queue.h"
+#include "queue/zm_elimqueue.h"
+
+#define ZM_ELIM_EMPTY   0
+#define ZM_ELIM_WAITING 1 /* a dequeuer is parked in the slot */
+#define ZM_ELIM_CLAIMED 2 /* an enqueuer is filling the slot */
+#define ZM_ELIM_FILLED  3 /* data is ready for the parked dequeuer */
+
+#define ZM_ELIM_SPINS       256 /* how long a dequeuer stays parked */
+#define ZM_ELIM_SCORE_MAX   16
+#define ZM_ELIM_PROBE_MASK  63  /* retry elimination every 64 ops when cold */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ZM_ELIM_RELAX() __builtin_ia32_pause()
+#else
+#define ZM_ELIM_RELAX() __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+/* Per-thread adaptivity: successful exchanges raise the score, misses
+ * lower it. A cold thread goes straight to the backend and only probes
+ * the array periodically, so uncontended runs pay almost nothing. */
+static zm_thread_local int elim_score = 0;
+static zm_thread_local unsigned elim_ops = 0;
+static zm_thread_local unsigned elim_seed = 0;
+
+static inline unsigned elim_rand(void) {
+    if (zm_unlikely(elim_seed == 0))
+        elim_seed = (unsigned)(zm_ptr_t)&elim_seed | 1;
+    elim_seed ^= elim_seed << 13;
+    elim_seed ^= elim_seed >> 17;
+    elim_seed ^= elim_seed << 5;
+    return elim_seed;
+}
+
+static inline int elim_enabled(void) {
+    return (elim_score > 0) || ((elim_ops++ & ZM_ELIM_PROBE_MASK) == 0);
+}
+
+static inline void elim_hit(void) {
+    if (elim_score < ZM_ELIM_SCORE_MAX)
+        elim_score += 2;
+}
+
+static inline void elim_miss(void) {
+    if (elim_score > 0)
+        elim_score--;
+}
+
+static inline void grow(zm_elimqueue_t *q, int width) {
+    if (width < ZM_ELIM_MAX_SLOTS)
+        zm_atomic_compare_exchange_strong(&q->width, &width, width + 1,
+                                          zm_memord_relaxed, zm_memord_relaxed);
+}
+
+static inline void shrink(zm_elimqueue_t *q, int width) {
+    if (width > 1)
+        zm_atomic_compare_exchange_strong(&q->width, &width, width - 1,
+                                          zm_memord_relaxed, zm_memord_relaxed);
+}
+
+/* Emptiness test that does not dereference any node: once a producer's
+ * enqueue has returned, head == tail means that item was consumed. */
+static inline int backend_isempty(zm_elimqueue_t *q) {
+    if (q->backend == ZM_GLQUEUE_IF)
+        return *(volatile zm_ptr_t *)&q->q.glqueue.head ==
+               *(volatile zm_ptr_t *)&q->q.glqueue.tail;
+    return zm_atomic_load(&q->q.msqueue.head, zm_memord_acquire) ==
+           zm_atomic_load(&q->q.msqueue.tail, zm_memord_acquire);
+}
+
+static inline int backend_enqueue(zm_elimqueue_t *q, void *data) {
+    if (q->backend == ZM_GLQUEUE_IF)
+        return zm_glqueue_enqueue(&q->q.glqueue, data);
+    return zm_msqueue_enqueue(&q->q.msqueue, data);
+}
+
+static inline int backend_dequeue(zm_elimqueue_t *q, void **data) {
+    if (q->backend == ZM_GLQUEUE_IF)
+        return zm_glqueue_dequeue(&q->q.glqueue, data);
+    return zm_msqueue_dequeue(&q->q.msqueue, data);
+}
+
+/* Hand data to a parked dequeuer. Returns 1 on success. */
+static inline int elim_give(zm_elimqueue_t *q, void *data) {
+    int width = zm_atomic_load(&q->width, zm_memord_relaxed);
+    int start = elim_rand() % width;
+    for (int i = 0; i < width; i++) {
+        zm_elimslot_t *slot = &q->slots[(start + i) % width];
+        int state = ZM_ELIM_WAITING;
+        if (zm_atomic_load(&slot->state, zm_memord_relaxed) != ZM_ELIM_WAITING)
+            continue;
+        if (zm_atomic_compare_exchange_strong(&slot->state, &state, ZM_ELIM_CLAIMED,
+                                              zm_memord_acquire, zm_memord_relaxed)) {
+            slot->data = data;
+            zm_atomic_store(&slot->state, ZM_ELIM_FILLED, zm_memord_release);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Park in a slot for a bounded time waiting for an enqueuer. */
+static inline int elim_take(zm_elimqueue_t *q, void **data) {
+    int width = zm_atomic_load(&q->width, zm_memord_relaxed);
+    int start = elim_rand() % width;
+    zm_elimslot_t *slot = NULL;
+    for (int i = 0; i < width; i++) {
+        int state = ZM_ELIM_EMPTY;
+        zm_elimslot_t *s = &q->slots[(start + i) % width];
+        if (zm_atomic_compare_exchange_strong(&s->state, &state, ZM_ELIM_WAITING,
+                                              zm_memord_relaxed, zm_memord_relaxed)) {
+            slot = s;
+            break;
+        }
+        /* collided with another parked dequeuer: spread out */
+        grow(q, width);
+    }
+    if (slot == NULL)
+        return 0;
+
+    for (int i = 0; i < ZM_ELIM_SPINS; i++) {
+        if (zm_atomic_load(&slot->state, zm_memord_relaxed) != ZM_ELIM_WAITING)
+            break;
+        ZM_ELIM_RELAX();
+    }
+
+    int state = ZM_ELIM_WAITING;
+    if (zm_atomic_compare_exchange_strong(&slot->state, &state, ZM_ELIM_EMPTY,
+                                          zm_memord_relaxed, zm_memord_relaxed)) {
+        /* timed out: fewer slots make meetings more likely */
+        shrink(q, width);
+        return 0;
+    }
+    /* an enqueuer claimed the slot; wait for its data */
+    while (zm_atomic_load(&slot->state, zm_memord_acquire) != ZM_ELIM_FILLED)
+        ZM_ELIM_RELAX();
+    *data = slot->data;
+    zm_atomic_store(&slot->state, ZM_ELIM_EMPTY, zm_memord_release);
+    return 1;
+}
+
+int zm_elimqueue_init(zm_elimqueue_t *q, int backend) {
+    q->backend = backend;
+    if (backend == ZM_GLQUEUE_IF)
+        zm_glqueue_init(&q->q.glqueue);
+    else {
+        q->backend = ZM_MSQUEUE_IF;
+        zm_msqueue_init(&q->q.msqueue);
+    }
+
+    posix_memalign((void **) &q->slots, ZM_CACHELINE_SIZE,
+                   sizeof(zm_elimslot_t) * ZM_ELIM_MAX_SLOTS);
+    for (int i = 0; i < ZM_ELIM_MAX_SLOTS; i++) {
+        q->slots[i].data = NULL;
+        zm_atomic_store(&q->slots[i].state, ZM_ELIM_EMPTY, zm_memord_relaxed);
+    }
+    zm_atomic_store(&q->width, 1, zm_memord_release);
+    return 0;
+}
+
+int zm_elimqueue_destroy(zm_elimqueue_t *q) {
+    free(q->slots);
+    return 0;
+}
+
+int zm_elimqueue_enqueue(zm_elimqueue_t* q, void *data) {
+    if (elim_enabled() && backend_isempty(q)) {
+        if (elim_give(q, data)) {
+            elim_hit();
+            return 0;
+        }
+        elim_miss();
+    }
+    return backend_enqueue(q, data);
+}
+
+int zm_elimqueue_dequeue(zm_elimqueue_t* q, void **data) {
+    int ret = backend_dequeue(q, data);
+    if (*data != NULL || !elim_enabled())
+        return ret;
+    if (elim_take(q, data)) {
+        elim_hit();
+        return 1;
+    }
+    elim_miss();
+    return ret;
+}
@@ -0,0 +1,33 @@
+/* -*- Mode: C; c-basic-offset:4 ; indent-tabs-mode:nil ; -*- */
+/*
+ * See COPYRIGHT in top-level directory.
+ */
+
+#include <string.h>
+#include <strings.h>
+#include "queue/zm_queue.h"
+
+/* queue interface chosen at runtime (-DZM_QUEUE_SELECT with a runtime
+ * ZM_QUEUE_CONF) */
+int zm_queue_if = ZM_GLQUEUE_IF;
+
+/* Map a ZM_QUEUE_IF environment value to its interface, -1 if unknown */
+int zm_queue_parse_name(const char *name) {
+    static const struct {
+        const char *name;
+        int queue_if;
+    } names[] = {
+        {"glqueue",   ZM_GLQUEUE_IF},
+        {"msqueue",   ZM_MSQUEUE_IF},
+        {"swpqueue",  ZM_SWPQUEUE_IF},
+        {"faqueue",   ZM_FAQUEUE_IF},
+        {"mpbqueue",  ZM_MPBQUEUE_IF},
+        {"multqueue", ZM_MULTQUEUE_IF},
+        {"elimqueue", ZM_ELIMQUEUE_IF},
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        if (strcasecmp(name, names[i].name) == 0)
+            return names[i].queue_if;
+    return -1;
+}
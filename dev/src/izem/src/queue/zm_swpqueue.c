@@ -0,0 +1,96 @@
+/* -*- Mode: C; c-basic-offset:4 ; indent-tabs-mode:nil ; -*- */
+/*
+ * See COPYRIGHT in top-level directory.
+ */
+
+#include <stdlib.h>
+#include "queue/zm_swpqueue.h"
+
+static inline zm_swpqnode_t *new_node(void *data) {
+    zm_swpqnode_t *node;
+    posix_memalign((void **) &node, ZM_CACHELINE_SIZE, sizeof(zm_swpqnode_t));
+    node->data = data;
+    zm_atomic_store(&node->next, ZM_NULL, zm_memord_relaxed);
+    return node;
+}
+
+int zm_swpqueue_init(zm_swpqueue_t *q) {
+    zm_swpqnode_t *node = new_node(NULL);
+    zm_atomic_store(&q->head, (zm_ptr_t)node, zm_memord_release);
+    zm_atomic_store(&q->tail, (zm_ptr_t)node, zm_memord_release);
+    return 0;
+}
+
+/* Wait-free: a single exchange on the tail publishes the node, then the
+ * predecessor is linked to it. Between the two steps the node is not yet
+ * reachable from the head; the consumer simply sees the queue as shorter. */
+int zm_swpqueue_enqueue(zm_swpqueue_t* q, void *data) {
+    zm_swpqnode_t *node = new_node(data);
+    zm_swpqnode_t *pred;
+    pred = (zm_swpqnode_t*)zm_atomic_exchange_ptr(&q->tail, (zm_ptr_t)node, zm_memord_acq_rel);
+    zm_atomic_store(&pred->next, (zm_ptr_t)node, zm_memord_release);
+    return 0;
+}
+
+/* Links n elements privately and publishes the whole chain with the
+ * same single exchange; the chain keeps its order. */
+int zm_swpqueue_enqueue_bulk(zm_swpqueue_t* q, void **data, int n) {
+    zm_swpqnode_t *first, *last, *pred;
+
+    if (n <= 0)
+        return 0;
+    first = last = new_node(data[0]);
+    for (int i = 1; i < n; i++) {
+        zm_swpqnode_t *node = new_node(data[i]);
+        zm_atomic_store(&last->next, (zm_ptr_t)node, zm_memord_relaxed);
+        last = node;
+    }
+    pred = (zm_swpqnode_t*)zm_atomic_exchange_ptr(&q->tail, (zm_ptr_t)last, zm_memord_acq_rel);
+    zm_atomic_store(&pred->next, (zm_ptr_t)first, zm_memord_release);
+    return 0;
+}
+
+/* Single consumer only: no synchronization on the head. */
+int zm_swpqueue_dequeue(zm_swpqueue_t* q, void **data) {
+    zm_swpqnode_t *head = (zm_swpqnode_t*)zm_atomic_load(&q->head, zm_memord_relaxed);
+    zm_swpqnode_t *next = (zm_swpqnode_t*)zm_atomic_load(&head->next, zm_memord_acquire);
+    *data = NULL;
+    if ((zm_ptr_t)next == ZM_NULL)
+        return 0;
+    /* next becomes the new sentinel; its data slot is handed out */
+    *data = next->data;
+    zm_atomic_store(&q->head, (zm_ptr_t)next, zm_memord_relaxed);
+    free(head);
+    return 1;
+}
+
+/* Single consumer only: takes up to max elements with one head update.
+ * Returns the number of elements stored in data[]. */
+int zm_swpqueue_dequeue_bulk(zm_swpqueue_t* q, void **data, int max) {
+    zm_swpqnode_t *head = (zm_swpqnode_t*)zm_atomic_load(&q->head, zm_memord_relaxed);
+    zm_swpqnode_t *node = head, *next;
+    int n = 0;
+
+    while (n < max) {
+        next = (zm_swpqnode_t*)zm_atomic_load(&node->next, zm_memord_acquire);
+        if ((zm_ptr_t)next == ZM_NULL)
+            break;
+        data[n++] = next->data;
+        node = next;
+    }
+    if (n == 0)
+        return 0;
+    /* the last node taken is the new sentinel; free the ones before it */
+    zm_atomic_store(&q->head, (zm_ptr_t)node, zm_memord_relaxed);
+    while (head != node) {
+        next = (zm_swpqnode_t*)zm_atomic_load(&head->next, zm_memord_relaxed);
+        free(head);
+        head = next;
+    }
+    return n;
+}
+
+int zm_swpqueue_isempty(zm_swpqueue_t* q) {
+    zm_swpqnode_t *head = (zm_swpqnode_t*)zm_atomic_load(&q->head, zm_memord_relaxed);
+    return (zm_atomic_load(&head->next, zm_memord_acquire) == ZM_NULL);
+}
@@ -0,0 +1,442 @@
+/* -*- Mode: C; c-basic-offset:4 ; indent-tabs-mode:nil ; -*- */
+/*
+ *  (C) 2019 by Argonne National Laboratory.
+ *      See COPYRIGHT in top-level directory.
+ */
+
+#ifndef CH4_DEV_HOOKS_H_INCLUDED
+#define CH4_DEV_HOOKS_H_INCLUDED
+
+/*
+ * Call sites of the ./dev overlay in MPICH's ch4 device. When a build
+ * uses the overlay instrumentation, installMPICH.sh (hookDevSources)
+ * patches the unpacked sources:
+ *
+ *  - the header defining MPID_THREAD_SAFE_BEGIN/END includes this file
+ *    at its end, and its definitions are renamed to
+ *    MPIDI_DEV_SAFE_BEGIN_ORIG/MPIDI_DEV_SAFE_END_ORIG, which the
+ *    wrappers below call;
+ *  - MPID_Send/MPID_Isend and MPID_Recv/MPID_Irecv start with
+ *    MPIDI_DEV_HOOK_SEND/MPIDI_DEV_HOOK_RECV(comm, rank, tag);
+ *  - in -t builds, request completion starts with
+ *    MPIDI_DEV_HOOK_COMPLETE(req) and the lookups of ch4's posted and
+ *    unexpected queues with MPIDI_DEV_HOOK_MATCH(rank, tag);
+ *  - MPID_InitCompleted ends with MPIDI_DEV_HOOK_INIT() and
+ *    MPID_Finalize starts with MPIDI_DEV_HOOK_FINALIZE();
+ *  - in -m builds, ch4's hint hook (MPID_Comm_set_hints or
+ *    MPID_Comm_set_info) starts with MPIDI_DEV_HOOK_COMM_INFO(comm_ptr,
+ *    info_ptr) and MPID_Comm_free_hook with MPIDI_DEV_HOOK_COMM_FREE(comm);
+ *    where ch4 chooses among several VCIs, its MPIDI_get_vci is renamed
+ *    MPIDI_get_vci_ch4 and MPIDI_get_vci becomes MPIDI_DEV_GET_VCI.
+ *
+ * With -DMPIDI_CH4_MT_HYBRID (installMPICH.sh -p hybrid, a handoff
+ * build) every VCI critical section runs the ch4_vci_hybrid.h mode
+ * switch on ch4's own mutex: a missed trylock waits for the lock while
+ * the VCI is in TRYLOCK mode and goes to ch4's work queue in HANDOFF
+ * mode. ch4_workq.h, patched by hookDevWorkq, drains its work queue
+ * through MPIDI_DEV_WORKQ_DEQUEUE, which applies the batch size and the
+ * drain cap of ch4_vci_hybrid.h. With -DMPIDI_CH4_VCI_PROGRESS as well
+ * (-a) the init hook starts the ch4_vci_progress.h threads, and every
+ * operation handed to ch4's work queue wakes the thread of its VCI.
+ *
+ * With -DMPIDI_CH4_VCI_MAP (-m) ch4 routes every send and receive by
+ * the ch4_vci_map.h VCI, and the "vci" info key of a communicator sets
+ * its hint. The send and receive hooks count the VCI and tag the trace
+ * events with it; the finalize hook prints the spread. Sources without
+ * MPIDI_get_vci (a single VCI) only count.
+ *
+ * The hooks are macros, so MPICH's own types (MPIR_Comm, MPIR_Process)
+ * are only used at the call sites, where they are defined.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "ch4_trace.h"
+#include "ch4_vci_prof.h"
+#include "ch4_workq_pool.h"
+
+#ifdef MPIDI_CH4_VCI_MAP
+#include "ch4_vci_map.h"
+#endif
+
+#define MPIDI_DEV_MAX_VCIS 64   /* VCIs beyond this share the last id */
+
+#define MPIDI_DEV_HOOKS_WEAK __attribute__((weak))
+
+/* mutex of every critical section seen so far; the index is its VCI id */
+MPIDI_DEV_HOOKS_WEAK const void *MPIDI_dev_vci_mutex[MPIDI_DEV_MAX_VCIS];
+
+/* VCIs ch4 was asked for */
+static inline int MPIDI_dev_nvcis(void)
+{
+    const char *env = getenv("MPIR_CVAR_CH4_NUM_VCIS");
+
+    return env && atoi(env) > 0 ? atoi(env) : 1;
+}
+
+/* VCI id of the critical section protected by mutex, handed out in
+ * order of first use. */
+static inline int MPIDI_dev_vci(const void *mutex)
+{
+    int i;
+
+    for (i = 0; i < MPIDI_DEV_MAX_VCIS - 1; i++) {
+        const void *m = __atomic_load_n(&MPIDI_dev_vci_mutex[i], __ATOMIC_ACQUIRE);
+
+        /* a failed exchange leaves the mutex that took the slot in m */
+        if (m == NULL &&
+            __atomic_compare_exchange_n(&MPIDI_dev_vci_mutex[i], &m, mutex, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return i;
+        if (m == mutex)
+            return i;
+    }
+    return MPIDI_DEV_MAX_VCIS - 1;
+}
+
+#ifdef MPIDI_CH4_MT_HYBRID
+
+#include "queue/zm_queue.h"
+#include "ch4_vci_hybrid.h"
+#include "ch4_vci_progress.h"
+
+MPIDI_DEV_HOOKS_WEAK MPIDI_vci_hybrid_t MPIDI_dev_hybrid[MPIDI_DEV_MAX_VCIS];
+MPIDI_DEV_HOOKS_WEAK int MPIDI_dev_hybrid_ready;
+MPIDI_DEV_HOOKS_WEAK int MPIDI_dev_workq_batch = MPIDI_VCI_HYBRID_BATCH;
+MPIDI_DEV_HOOKS_WEAK int MPIDI_dev_workq_drain_max = MPIDI_VCI_HYBRID_DRAIN_MAX;
+
+/* a drain of ch4's work queue in progress on this thread */
+typedef struct MPIDI_dev_workq_drain {
+    zm_queue_t *q;              /* queue the batch was read from */
+    int next;                   /* batch[next..count) not handed out yet */
+    int count;
+    int taken;                  /* elements handed out by this drain */
+    void *batch[MPIDI_VCI_HYBRID_BATCH_MAX];
+} MPIDI_dev_workq_drain_t;
+
+MPIDI_DEV_HOOKS_WEAK __thread MPIDI_dev_workq_drain_t MPIDI_dev_workq_drain;
+
+/* Mode switch of vci if it runs on mutex; binds it on first use. VCIs past
+ * MPIDI_DEV_MAX_VCIS share an id and keep ch4's plain handoff. */
+static inline MPIDI_vci_hybrid_t *MPIDI_dev_hybrid_of(int vci, void *mutex)
+{
+    MPIDI_vci_hybrid_t *v = &MPIDI_dev_hybrid[vci];
+    MPID_Thread_mutex_t *m;
+
+    if (!__atomic_load_n(&MPIDI_dev_hybrid_ready, __ATOMIC_ACQUIRE))
+        return NULL;
+    m = __atomic_load_n(&v->mutex, __ATOMIC_ACQUIRE);
+    if (m == NULL) {
+        __atomic_compare_exchange_n(&v->mutex, &m, (MPID_Thread_mutex_t *) mutex, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        m = __atomic_load_n(&v->mutex, __ATOMIC_ACQUIRE);
+    }
+    return m == mutex ? v : NULL;
+}
+
+static inline void MPIDI_dev_hybrid_sample(int vci, void *mutex, int failed)
+{
+    MPIDI_vci_hybrid_t *v = MPIDI_dev_hybrid_of(vci, mutex);
+
+    if (v)
+        MPIDI_vci_hybrid_sample(v, failed);
+}
+
+/* After a missed trylock: in TRYLOCK mode wait for the lock and return 1 */
+static inline int MPIDI_dev_hybrid_wait(int vci, void *mutex)
+{
+    MPIDI_vci_hybrid_t *v = MPIDI_dev_hybrid_of(vci, mutex);
+
+    if (v == NULL || MPIDI_vci_hybrid_mode(v) != MPIDI_VCI_HYBRID_TRYLOCK)
+        return 0;
+    MPIDI_vci_hybrid_wait(v);
+    return 1;
+}
+
+/* The operation went to ch4's work queue */
+static inline void MPIDI_dev_hybrid_handed_off(int vci)
+{
+    MPIDI_vci_progress_wake(vci);
+}
+
+/* Next element for ch4's drain loop of q, NULL when the drain ends: the
+ * queue is empty or the drain took MPIDI_dev_workq_drain_max elements.
+ * Batch elements left over by a drain that stopped early (a failed
+ * dispatch) go back to their queue before another queue is read. */
+static inline void *MPIDI_dev_workq_dequeue(zm_queue_t * q)
+{
+    MPIDI_dev_workq_drain_t *d = &MPIDI_dev_workq_drain;
+    int n;
+
+    if (d->q != q) {
+        if (d->next < d->count)
+            zm_queue_enqueue_bulk(d->q, &d->batch[d->next], d->count - d->next);
+        d->q = q;
+        d->next = d->count = d->taken = 0;
+    }
+    if (d->next == d->count) {
+        n = MPIDI_dev_workq_drain_max - d->taken;
+        if (n > MPIDI_dev_workq_batch)
+            n = MPIDI_dev_workq_batch;
+        d->next = 0;
+        d->count = n > 0 ? zm_queue_dequeue_bulk(q, d->batch, n) : 0;
+        if (d->count == 0) {
+            /* at the cap, whoever polls progress next takes the rest */
+            if (n <= 0)
+                MPIDI_vci_progress_wake_all();
+            d->taken = 0;
+            MPIDI_workq_pool_flush();
+            return NULL;
+        }
+        MPIDI_TRACE(HANDOFF_DEQUEUE, 0, d->count, 0);
+    }
+    d->taken++;
+    return d->batch[d->next++];
+}
+
+/* Start nvcis progress threads only under MPI_THREAD_MULTIPLE (multiple
+ * set): otherwise ch4's critical sections are no-ops and a progress
+ * thread would race the application inside ch4. */
+static inline void MPIDI_dev_hybrid_init(MPIDI_vci_progress_poll_fn poll, int nvcis, int multiple)
+{
+    const char *env;
+    int i;
+
+    if ((env = getenv("MPIR_CVAR_CH4_VCI_HYBRID_BATCH")) != NULL && atoi(env) > 0)
+        MPIDI_dev_workq_batch = atoi(env) < MPIDI_VCI_HYBRID_BATCH_MAX ?
+            atoi(env) : MPIDI_VCI_HYBRID_BATCH_MAX;
+    if ((env = getenv("MPIR_CVAR_CH4_VCI_HYBRID_DRAIN_MAX")) != NULL && atoi(env) > 0)
+        MPIDI_dev_workq_drain_max = atoi(env);
+
+    for (i = 0; i < MPIDI_DEV_MAX_VCIS; i++)
+        MPIDI_vci_hybrid_init(&MPIDI_dev_hybrid[i], i,
+                              (MPID_Thread_mutex_t *) MPIDI_dev_vci_mutex[i]);
+    __atomic_store_n(&MPIDI_dev_hybrid_ready, 1, __ATOMIC_RELEASE);
+    if (multiple && nvcis > 0)
+        MPIDI_vci_progress_start(nvcis < MPIDI_DEV_MAX_VCIS ? nvcis : MPIDI_DEV_MAX_VCIS, poll);
+}
+
+/* Leave the critical sections to ch4. */
+static inline void MPIDI_dev_hybrid_finalize(void)
+{
+    MPIDI_vci_progress_stop();
+    __atomic_store_n(&MPIDI_dev_hybrid_ready, 0, __ATOMIC_RELEASE);
+}
+
+#else
+
+typedef int (*MPIDI_vci_progress_poll_fn) (int vci);
+
+static inline void MPIDI_dev_hybrid_sample(int vci, void *mutex, int failed)
+{
+    (void) vci;
+    (void) mutex;
+    (void) failed;
+}
+
+static inline int MPIDI_dev_hybrid_wait(int vci, void *mutex)
+{
+    (void) vci;
+    (void) mutex;
+    return 0;
+}
+
+static inline void MPIDI_dev_hybrid_handed_off(int vci)
+{
+    (void) vci;
+}
+
+static inline void MPIDI_dev_hybrid_init(MPIDI_vci_progress_poll_fn poll, int nvcis, int multiple)
+{
+    (void) poll;
+    (void) nvcis;
+    (void) multiple;
+}
+
+static inline void MPIDI_dev_hybrid_finalize(void)
+{
+}
+
+#endif /* MPIDI_CH4_MT_HYBRID */
+
+/* dequeue of ch4's drain loop, see hookDevWorkq in installMPICH.sh */
+#ifdef MPIDI_CH4_MT_HYBRID
+#define MPIDI_DEV_WORKQ_DEQUEUE(q, pp) (*(pp) = MPIDI_dev_workq_dequeue(q))
+#else
+#define MPIDI_DEV_WORKQ_DEQUEUE(q, pp)                  \
+    do {                                                \
+        MPIDI_WORKQ_POOL_DEQUEUE(q, pp);                \
+        if (*(pp) != NULL)                              \
+            MPIDI_TRACE(HANDOFF_DEQUEUE, 0, 1, 0);      \
+    } while (0)
+#endif
+
+#ifdef MPIDI_CH4_VCI_MAP
+
+/* ch4 routes operations during MPI_Init, before the init hook */
+static inline void MPIDI_dev_map_ready(void)
+{
+    if (__builtin_expect(!MPIDI_vci_map_global.ready, 0))
+        MPIDI_vci_map_init(MPIDI_dev_nvcis(), -1);
+}
+
+static inline int MPIDI_dev_map_select(int context_id, int rank, int tag, int dir)
+{
+    MPIDI_dev_map_ready();
+    return MPIDI_vci_map_select(context_id, rank, tag, dir);
+}
+
+/* ch4's MPIDI_get_vci: bit 1 of flag is set on the receiving side
+ * (SRC/DST_VCI_FROM_RECVR), which matches on the receive context id, the
+ * sender's context id on an intercommunicator */
+static inline int MPIDI_dev_get_vci(int flag, int context_id, int src_rank, int dst_rank, int tag)
+{
+    MPIDI_dev_map_ready();
+    if (flag & 2)
+        return MPIDI_vci_map_route(context_id, src_rank, tag, MPIDI_VCI_MAP_RECV);
+    return MPIDI_vci_map_route(context_id, dst_rank, tag, MPIDI_VCI_MAP_SEND);
+}
+
+/* hints of intercommunicators would be looked up by two context ids, so
+ * they keep the comm policy */
+static inline void MPIDI_dev_map_info(int context_id, int recvcontext_id, const char *key,
+                                      const char *value)
+{
+    MPIDI_dev_map_ready();
+    if (key != NULL && value != NULL && context_id == recvcontext_id)
+        MPIDI_vci_map_info_hint(context_id, key, value);
+}
+
+#define MPIDI_DEV_MAP_INIT(rank)              MPIDI_vci_map_init(MPIDI_dev_nvcis(), rank)
+#define MPIDI_DEV_MAP_SELECT(ctx, rank, tag, dir) \
+    MPIDI_dev_map_select(ctx, rank, tag, MPIDI_VCI_MAP_##dir)
+#define MPIDI_DEV_MAP_FINALIZE(rank)          MPIDI_vci_map_finalize(rank)
+
+#define MPIDI_DEV_GET_VCI(flag, comm, src_rank, dst_rank, tag)          \
+    MPIDI_dev_get_vci(flag, ((flag) & 2) ? (comm)->recvcontext_id : (comm)->context_id, \
+                      src_rank, dst_rank, tag)
+
+/* MPIR_Info is a list behind an empty head */
+#define MPIDI_DEV_HOOK_COMM_INFO(comm, info)                            \
+    do {                                                                \
+        MPIR_Info *info_;                                               \
+        for (info_ = (info) ? (info)->next : NULL; info_ != NULL; info_ = info_->next) \
+            MPIDI_dev_map_info((comm)->context_id, (comm)->recvcontext_id, \
+                               info_->key, info_->value);               \
+    } while (0)
+#define MPIDI_DEV_HOOK_COMM_FREE(comm) MPIDI_vci_map_set_hint((comm)->context_id, -1)
+
+#else
+#define MPIDI_DEV_MAP_INIT(rank)              ((void) (rank), 0)
+#define MPIDI_DEV_MAP_SELECT(ctx, rank, tag, dir) ((void) (ctx), 0)
+#define MPIDI_DEV_MAP_FINALIZE(rank)          ((void) (rank), 0)
+#define MPIDI_DEV_HOOK_COMM_INFO(comm, info)  ((void) (comm), (void) (info))
+#define MPIDI_DEV_HOOK_COMM_FREE(comm)        ((void) (comm))
+#endif
+
+static inline void MPIDI_dev_hook_send(int context_id, int rank, int tag)
+{
+    int vci = MPIDI_DEV_MAP_SELECT(context_id, rank, tag, SEND);
+
+    MPIDI_TRACE(SEND_POST, vci, rank, tag);
+}
+
+static inline void MPIDI_dev_hook_recv(int context_id, int rank, int tag)
+{
+    int vci = MPIDI_DEV_MAP_SELECT(context_id, rank, tag, RECV);
+
+    MPIDI_TRACE(RECV_POST, vci, rank, tag);
+}
+
+static inline void MPIDI_dev_hook_init(int rank, MPIDI_vci_progress_poll_fn poll, int nvcis,
+                                       int multiple)
+{
+    MPIDI_TRACE_INIT();
+    (void) MPIDI_DEV_MAP_INIT(rank);
+    MPIDI_dev_hybrid_init(poll, nvcis, multiple);
+}
+
+static inline void MPIDI_dev_hook_finalize(int rank)
+{
+    MPIDI_dev_hybrid_finalize();
+    MPIDI_VCI_PROF_FINALIZE(rank);
+    (void) MPIDI_DEV_MAP_FINALIZE(rank);
+    MPIDI_workq_pool_finalize();
+    MPIDI_TRACE_FINALIZE();
+}
+
+#define MPIDI_DEV_HOOK_SEND(comm, rank, tag) MPIDI_dev_hook_send((comm)->context_id, rank, tag)
+#define MPIDI_DEV_HOOK_RECV(comm, rank, tag) MPIDI_dev_hook_recv((comm)->recvcontext_id, rank, tag)
+#define MPIDI_DEV_HOOK_MATCH(rank, tag)      MPIDI_TRACE(MATCH, 0, rank, tag)
+#define MPIDI_DEV_HOOK_COMPLETE(req)                                    \
+    do {                                                                \
+        if ((req)->kind == MPIR_REQUEST_KIND__SEND)                     \
+            MPIDI_TRACE(SEND_COMPLETE, 0, 0, 0);                        \
+        else if ((req)->kind == MPIR_REQUEST_KIND__RECV)                \
+            MPIDI_TRACE(RECV_COMPLETE, 0, (req)->status.MPI_SOURCE,     \
+                        (req)->status.MPI_TAG);                         \
+    } while (0)
+
+/* progress of the ch4_vci_progress.h threads: per VCI where ch4 has it,
+ * else one thread on the global progress (MPID_Progress_poke is only
+ * declared at the init call site, so the hook stores it there) */
+MPIDI_DEV_HOOKS_WEAK int (*MPIDI_dev_progress_global) (void);
+
+static inline int MPIDI_dev_progress_poke(int vci)
+{
+    (void) vci;
+    return MPIDI_dev_progress_global();
+}
+
+#if defined(MPIDI_CH4_VCI_PROGRESS) && defined(MPIDI_DEV_PROGRESS_VCI)
+#define MPIDI_DEV_PROGRESS_POLL MPIDI_progress_test_vci
+#define MPIDI_DEV_PROGRESS_VCIS MPIDI_dev_nvcis()
+#elif defined(MPIDI_CH4_VCI_PROGRESS)
+#define MPIDI_DEV_PROGRESS_POLL \
+    (MPIDI_dev_progress_global = MPID_Progress_poke, MPIDI_dev_progress_poke)
+#define MPIDI_DEV_PROGRESS_VCIS 1
+#else
+#define MPIDI_DEV_PROGRESS_POLL NULL
+#define MPIDI_DEV_PROGRESS_VCIS 0
+#endif
+
+#define MPIDI_DEV_HOOK_INIT()                                           \
+    MPIDI_dev_hook_init(MPIR_Process.comm_world->rank, MPIDI_DEV_PROGRESS_POLL, \
+                        MPIDI_DEV_PROGRESS_VCIS,                        \
+                        MPIR_ThreadInfo.thread_provided == MPI_THREAD_MULTIPLE)
+#define MPIDI_DEV_HOOK_FINALIZE() MPIDI_dev_hook_finalize(MPIR_Process.comm_world->rank)
+
+/* cs_acq is 0 after BEGIN if the operation goes to ch4's handoff queue */
+#define MPID_THREAD_SAFE_BEGIN(name, mutex, cs_acq)                     \
+    do {                                                                \
+        int vci_ = MPIDI_dev_vci(&(mutex));                             \
+        MPIDI_VCI_PROF_WAIT_BEGIN(vci_);                                \
+        MPIDI_DEV_SAFE_BEGIN_ORIG(name, mutex, cs_acq);                 \
+        MPIDI_dev_hybrid_sample(vci_, &(mutex), !(cs_acq));             \
+        if (!(cs_acq)) {                                                \
+            MPIDI_VCI_PROF_TRYLOCK_FAILED(vci_);                        \
+            if (MPIDI_dev_hybrid_wait(vci_, &(mutex)))                  \
+                cs_acq = 1;                                             \
+        }                                                               \
+        if (cs_acq) {                                                   \
+            MPIDI_VCI_PROF_ACQUIRED(vci_);                              \
+            MPIDI_TRACE(VCI_LOCK_ACQUIRE, vci_, 0, 0);                  \
+        } else {                                                        \
+            MPIDI_VCI_PROF_HANDOFF(vci_);                               \
+            MPIDI_TRACE(HANDOFF_ENQUEUE, vci_, 0, 0);                   \
+        }                                                               \
+    } while (0)
+
+#define MPID_THREAD_SAFE_END(name, mutex, cs_acq)                       \
+    do {                                                                \
+        if (cs_acq) {                                                   \
+            int vci_ = MPIDI_dev_vci(&(mutex));                         \
+            MPIDI_VCI_PROF_RELEASE(vci_);                               \
+            MPIDI_TRACE(VCI_LOCK_RELEASE, vci_, 0, 0);                  \
+        }                                                               \
+        MPIDI_DEV_SAFE_END_ORIG(name, mutex, cs_acq);                   \
+        if (!(cs_acq))                                                  \
+            MPIDI_dev_hybrid_handed_off(MPIDI_dev_vci(&(mutex)));       \
+    } while (0)
+
+#endif /* CH4_DEV_HOOKS_H_INCLUDED */
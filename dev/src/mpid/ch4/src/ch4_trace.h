@@ -0,0 +1,293 @@
+/* -*- Mode: C; c-basic-offset:4 ; indent-tabs-mode:nil ; -*- */
+/*
+ *  (C) 2019 by Argonne National Laboratory.
+ *      See COPYRIGHT in top-level directory.
+ */
+
+#ifndef CH4_TRACE_H_INCLUDED
+#define CH4_TRACE_H_INCLUDED
+
+/*
+ * Hot-path event tracer, compiled in with -DMPIDI_CH4_TRACE
+ * (installMPICH.sh -t) and a no-op otherwise.
+ *
+ * Each thread appends rdtsc-stamped records to its own ring; only the
+ * owner writes it, so recording is a handful of plain stores. A ring
+ * keeps the newest MPIR_CVAR_CH4_TRACE_EVENTS records (power of two,
+ * default 65536). MPIDI_TRACE_FINALIZE() and the signal
+ * MPIR_CVAR_CH4_TRACE_SIGNAL (default SIGUSR2, 0 disables) write all
+ * rings to MPIR_CVAR_CH4_TRACE_PREFIX.<pid>.bin ("ch4trace" by default).
+ * traceToTimeline.py in the top-level directory converts those files to
+ * the Chrome/Perfetto trace format.
+ *
+ * ch4_dev_hooks.h records MPID_Send/MPID_Isend (SEND_POST), MPID_Recv/
+ * MPID_Irecv (RECV_POST), lookups in ch4's posted and unexpected queues
+ * (MATCH), request completions (SEND_COMPLETE/RECV_COMPLETE), the per-VCI
+ * critical section (VCI_LOCK_ACQUIRE/VCI_LOCK_RELEASE), operations handed
+ * to ch4's work queue (HANDOFF_ENQUEUE) and taken from it by the drain
+ * (HANDOFF_DEQUEUE, a0 elements), and calls MPIDI_TRACE_INIT()/
+ * MPIDI_TRACE_FINALIZE() from MPID_InitCompleted/MPID_Finalize.
+ * Completions record the status source and tag; ch4 hands receives
+ * matched by the netmod to the completion hook only.
+ *
+ * The header is self-contained: shared state is defined weak, so every
+ * translation unit including it uses the same rings without any change
+ * to the build system.
+ */
+
+#define MPIDI_TRACE_SEND_POST        0
+#define MPIDI_TRACE_RECV_POST        1
+#define MPIDI_TRACE_MATCH            2
+#define MPIDI_TRACE_SEND_COMPLETE    3
+#define MPIDI_TRACE_RECV_COMPLETE    4
+#define MPIDI_TRACE_VCI_LOCK_ACQUIRE 5
+#define MPIDI_TRACE_VCI_LOCK_RELEASE 6
+#define MPIDI_TRACE_HANDOFF_ENQUEUE  7
+#define MPIDI_TRACE_HANDOFF_DEQUEUE  8
+#define MPIDI_TRACE_USER             9  /* first id free for ad-hoc events */
+
+#ifdef MPIDI_CH4_TRACE
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "rdtsc.h"
+
+#define MPIDI_TRACE_MAGIC          "CH4TRACE"
+#define MPIDI_TRACE_VERSION        1
+#define MPIDI_TRACE_DEFAULT_EVENTS 65536
+#define MPIDI_TRACE_PATH_MAX       256
+
+#define MPIDI_TRACE_WEAK __attribute__((weak))
+
+/* On-disk layout, native byte order:
+ *   file header, then per ring a ring header and nrecords records,
+ *   oldest first. */
+typedef struct MPIDI_trace_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t nrings;
+    uint32_t pid;
+    uint32_t record_size;
+    double ns_per_tick;
+} MPIDI_trace_file_header_t;
+
+typedef struct MPIDI_trace_ring_header {
+    uint32_t tid;
+    uint32_t reserved;
+    uint64_t nrecords;
+} MPIDI_trace_ring_header_t;
+
+typedef struct MPIDI_trace_record {
+    uint64_t tsc;
+    uint32_t event;
+    uint32_t vci;
+    uint64_t arg[2];
+} MPIDI_trace_record_t;
+
+typedef struct MPIDI_trace_ring {
+    uint64_t head;              /* records ever written */
+    uint64_t mask;
+    uint32_t tid;
+    struct MPIDI_trace_ring *next;
+    MPIDI_trace_record_t *records;
+} MPIDI_trace_ring_t;
+
+typedef struct MPIDI_trace_global {
+    uint64_t nevents;           /* ring capacity, 0 while tracing is off */
+    uint32_t next_tid;
+    int signum;
+    double ns_per_tick;
+    MPIDI_trace_ring_t *rings;
+    char path[MPIDI_TRACE_PATH_MAX];
+} MPIDI_trace_global_t;
+
+MPIDI_TRACE_WEAK MPIDI_trace_global_t MPIDI_trace_global;
+MPIDI_TRACE_WEAK __thread MPIDI_trace_ring_t *MPIDI_trace_tls_ring;
+
+static inline MPIDI_trace_ring_t *MPIDI_trace_ring_create(void)
+{
+    MPIDI_trace_ring_t *ring;
+    uint64_t nevents = MPIDI_trace_global.nevents;
+
+    if (nevents == 0)
+        return NULL;
+    ring = (MPIDI_trace_ring_t *) calloc(1, sizeof(MPIDI_trace_ring_t));
+    if (ring == NULL)
+        return NULL;
+    if (posix_memalign((void **) &ring->records, 64, nevents * sizeof(MPIDI_trace_record_t))) {
+        free(ring);
+        return NULL;
+    }
+    ring->mask = nevents - 1;
+    ring->tid = __atomic_fetch_add(&MPIDI_trace_global.next_tid, 1, __ATOMIC_RELAXED);
+    ring->next = __atomic_load_n(&MPIDI_trace_global.rings, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&MPIDI_trace_global.rings, &ring->next, ring, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+    MPIDI_trace_tls_ring = ring;
+    return ring;
+}
+
+static inline void MPIDI_trace_event(uint32_t event, uint32_t vci, uint64_t a0, uint64_t a1)
+{
+    MPIDI_trace_ring_t *ring = MPIDI_trace_tls_ring;
+    MPIDI_trace_record_t *rec;
+
+    if (__builtin_expect(ring == NULL, 0) && (ring = MPIDI_trace_ring_create()) == NULL)
+        return;
+    rec = &ring->records[ring->head & ring->mask];
+    rec->tsc = rdtsc();
+    rec->event = event;
+    rec->vci = vci;
+    rec->arg[0] = a0;
+    rec->arg[1] = a1;
+    /* publish after the record so a concurrent flush sees whole records */
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+static inline int MPIDI_trace_write(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *) buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+/* Write every ring to the trace file. Uses only async-signal-safe calls,
+ * so it may run from the signal handler; records being written by other
+ * threads at that moment may come out torn. */
+static inline int MPIDI_trace_flush(void)
+{
+    MPIDI_trace_file_header_t hdr;
+    MPIDI_trace_ring_t *rings, *ring;
+    int fd, ret = 0;
+
+    if (MPIDI_trace_global.path[0] == '\0')
+        return -1;
+    fd = open(MPIDI_trace_global.path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+
+    rings = __atomic_load_n(&MPIDI_trace_global.rings, __ATOMIC_ACQUIRE);
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, MPIDI_TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = MPIDI_TRACE_VERSION;
+    for (ring = rings; ring != NULL; ring = ring->next)
+        hdr.nrings++;
+    hdr.pid = (uint32_t) getpid();
+    hdr.record_size = sizeof(MPIDI_trace_record_t);
+    hdr.ns_per_tick = MPIDI_trace_global.ns_per_tick;
+    ret |= MPIDI_trace_write(fd, &hdr, sizeof(hdr));
+
+    for (ring = rings; ring != NULL && ret == 0; ring = ring->next) {
+        MPIDI_trace_ring_header_t rhdr;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t capacity = ring->mask + 1;
+        uint64_t first = head & ring->mask;
+
+        rhdr.tid = ring->tid;
+        rhdr.reserved = 0;
+        rhdr.nrecords = head > capacity ? capacity : head;
+        ret |= MPIDI_trace_write(fd, &rhdr, sizeof(rhdr));
+        /* oldest first: once wrapped, from the write position to the end
+         * of the array, then its start */
+        if (head > capacity) {
+            ret |= MPIDI_trace_write(fd, &ring->records[first],
+                                     (capacity - first) * sizeof(MPIDI_trace_record_t));
+            ret |= MPIDI_trace_write(fd, ring->records, first * sizeof(MPIDI_trace_record_t));
+        } else {
+            ret |= MPIDI_trace_write(fd, ring->records, head * sizeof(MPIDI_trace_record_t));
+        }
+    }
+    close(fd);
+    return ret;
+}
+
+static inline void MPIDI_trace_signal_handler(int signum)
+{
+    (void) signum;
+    MPIDI_trace_flush();
+}
+
+static inline int MPIDI_trace_init(void)
+{
+    const char *env;
+    uint64_t nevents = MPIDI_TRACE_DEFAULT_EVENTS;
+    const char *prefix = "ch4trace";
+
+    env = getenv("MPIR_CVAR_CH4_TRACE_EVENTS");
+    if (env && atol(env) > 0)
+        nevents = (uint64_t) atol(env);
+    while (nevents & (nevents - 1))     /* round up to a power of two */
+        nevents += nevents & -nevents;
+    env = getenv("MPIR_CVAR_CH4_TRACE_PREFIX");
+    if (env && *env)
+        prefix = env;
+    snprintf(MPIDI_trace_global.path, MPIDI_TRACE_PATH_MAX, "%s.%d.bin", prefix, (int) getpid());
+
+    rdtsc_calibrate();
+    MPIDI_trace_global.ns_per_tick = rdtsc_ns_per_tick;
+    MPIDI_trace_global.signum = SIGUSR2;
+    env = getenv("MPIR_CVAR_CH4_TRACE_SIGNAL");
+    if (env)
+        MPIDI_trace_global.signum = atoi(env);
+    if (MPIDI_trace_global.signum > 0)
+        signal(MPIDI_trace_global.signum, MPIDI_trace_signal_handler);
+
+    __atomic_store_n(&MPIDI_trace_global.nevents, nevents, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Flush and release the rings. Other threads must no longer record. */
+static inline int MPIDI_trace_finalize(void)
+{
+    MPIDI_trace_ring_t *ring, *next;
+    int ret;
+
+    __atomic_store_n(&MPIDI_trace_global.nevents, 0, __ATOMIC_RELEASE);
+    if (MPIDI_trace_global.signum > 0)
+        signal(MPIDI_trace_global.signum, SIG_DFL);
+    ret = MPIDI_trace_flush();
+    for (ring = MPIDI_trace_global.rings; ring != NULL; ring = next) {
+        next = ring->next;
+        free(ring->records);
+        free(ring);
+    }
+    MPIDI_trace_global.rings = NULL;
+    MPIDI_trace_tls_ring = NULL;
+    return ret;
+}
+
+#define MPIDI_TRACE(event, vci, a0, a1) \
+    MPIDI_trace_event(MPIDI_TRACE_##event, (uint32_t) (vci), (uint64_t) (a0), (uint64_t) (a1))
+#define MPIDI_TRACE_INIT()     MPIDI_trace_init()
+#define MPIDI_TRACE_FINALIZE() MPIDI_trace_finalize()
+
+#else
+
+#define MPIDI_TRACE(event, vci, a0, a1) do { (void) (vci); (void) (a0); (void) (a1); } while (0)
+#define MPIDI_TRACE_INIT()     MPIDI_trace_init()
+#define MPIDI_TRACE_FINALIZE() MPIDI_trace_finalize()
+
+static inline int MPIDI_trace_init(void)
+{
+    return 0;
+}
+
+static inline int MPIDI_trace_finalize(void)
+{
+    return 0;
+}
+
+#endif /* MPIDI_CH4_TRACE */
+
+#endif /* CH4_TRACE_H_INCLUDED */
@@ -0,0 +1,133 @@
+/* -*- Mode: C; c-basic-offset:4 ; indent-tabs-mode:nil ; -*- */
+/*
+ *  (C) 2019 by Argonne National Laboratory.
+ *      See COPYRIGHT in top-level directory.
+ */
+
+#ifndef CH4_VCI_HYBRID_H_INCLUDED
+#define CH4_VCI_HYBRID_H_INCLUDED
+
+/*
+ * Hybrid per-VCI critical section (installMPICH.sh -p hybrid, which
+ * builds the handoff configuration with -DMPIDI_CH4_MT_HYBRID).
+ *
+ * Every operation first tries the VCI lock, which is ch4's own
+ * critical-section mutex of the VCI. A VCI is in one of two modes,
+ * chosen from the failure rate of those trylocks over windows of
+ * MPIDI_VCI_HYBRID_WINDOW attempts:
+ *
+ *  TRYLOCK  a thread that misses the lock waits for it and runs the
+ *           operation itself (cheapest at low contention);
+ *  HANDOFF  a thread that misses the lock hands the operation to ch4's
+ *           work queue, as in the plain handoff build; the VCI owner
+ *           dispatches it from ch4's progress.
+ *
+ * The VCI switches to HANDOFF when at least MPIR_CVAR_CH4_VCI_HYBRID_HIGH
+ * percent (default 50) of a window's trylocks fail, and back to TRYLOCK
+ * only once the rate drops to MPIR_CVAR_CH4_VCI_HYBRID_LOW percent
+ * (default 10) or less, so it does not flap around a single threshold.
+ *
+ * ch4's drain of its work queue reads the queue in batches of
+ * MPIR_CVAR_CH4_VCI_HYBRID_BATCH elements (default 32), each taken with
+ * one zm_queue_dequeue_bulk(), and ends after
+ * MPIR_CVAR_CH4_VCI_HYBRID_DRAIN_MAX elements (default 256) even if the
+ * queue is not empty: the VCI lock is released, and the progress
+ * threads (ch4_vci_progress.h) or the next progress call take over the
+ * rest.
+ *
+ * ch4_dev_hooks.h applies the mode to every ch4 critical section and
+ * the cap to ch4's drain (MPIDI_DEV_WORKQ_DEQUEUE); the lock is taken with MPID_THREAD_CS_ENTER on the
+ * MPIDI_VCI_HYBRID_CS_NAME critical section (VNI, or VCI in MPICH
+ * versions that renamed it).
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ch4_workq_pool.h"
+
+#ifndef MPIDI_VCI_HYBRID_CS_NAME
+#define MPIDI_VCI_HYBRID_CS_NAME VNI
+#endif
+
+/* expand the name before MPID_THREAD_CS_ENTER pastes it */
+#define MPIDI_VCI_HYBRID_CS_ENTER_(name, m) MPID_THREAD_CS_ENTER(name, *(m))
+#define MPIDI_VCI_HYBRID_CS_ENTER(m) MPIDI_VCI_HYBRID_CS_ENTER_(MPIDI_VCI_HYBRID_CS_NAME, m)
+
+#define MPIDI_VCI_HYBRID_TRYLOCK 0
+#define MPIDI_VCI_HYBRID_HANDOFF 1
+
+#define MPIDI_VCI_HYBRID_WINDOW      256        /* trylock attempts per decision */
+#define MPIDI_VCI_HYBRID_HIGH_PCT    50
+#define MPIDI_VCI_HYBRID_LOW_PCT     10
+#define MPIDI_VCI_HYBRID_BATCH       32         /* elements per bulk dequeue */
+#define MPIDI_VCI_HYBRID_BATCH_MAX   256
+#define MPIDI_VCI_HYBRID_DRAIN_MAX   256        /* elements per drain */
+
+typedef struct MPIDI_vci_hybrid {
+    MPID_Thread_mutex_t *mutex MPIDI_WORKQ_POOL_ALIGNED;        /* ch4's VCI lock */
+    int mode;
+    int id;
+    int high_pct;
+    int low_pct;
+    uint64_t switches;          /* mode changes so far */
+    /* trylock statistics of the current window */
+    int attempts MPIDI_WORKQ_POOL_ALIGNED;
+    int fails;
+} MPIDI_vci_hybrid_t;
+
+static inline void MPIDI_vci_hybrid_init(MPIDI_vci_hybrid_t * v, int id,
+                                         MPID_Thread_mutex_t * mutex)
+{
+    const char *env;
+
+    memset(v, 0, sizeof(*v));
+    v->id = id;
+    v->mutex = mutex;
+    v->mode = MPIDI_VCI_HYBRID_TRYLOCK;
+    v->high_pct = MPIDI_VCI_HYBRID_HIGH_PCT;
+    v->low_pct = MPIDI_VCI_HYBRID_LOW_PCT;
+    if ((env = getenv("MPIR_CVAR_CH4_VCI_HYBRID_HIGH")) != NULL)
+        v->high_pct = atoi(env);
+    if ((env = getenv("MPIR_CVAR_CH4_VCI_HYBRID_LOW")) != NULL)
+        v->low_pct = atoi(env);
+    if (v->low_pct > v->high_pct)
+        v->low_pct = v->high_pct;
+}
+
+static inline int MPIDI_vci_hybrid_mode(MPIDI_vci_hybrid_t * v)
+{
+    return __atomic_load_n(&v->mode, __ATOMIC_RELAXED);
+}
+
+/* Account one trylock; the thread completing a window decides the mode. */
+static inline void MPIDI_vci_hybrid_sample(MPIDI_vci_hybrid_t * v, int failed)
+{
+    int fails, pct, mode;
+
+    if (failed)
+        __atomic_fetch_add(&v->fails, 1, __ATOMIC_RELAXED);
+    if (__atomic_add_fetch(&v->attempts, 1, __ATOMIC_RELAXED) != MPIDI_VCI_HYBRID_WINDOW)
+        return;
+
+    fails = __atomic_exchange_n(&v->fails, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&v->attempts, 0, __ATOMIC_RELAXED);
+    pct = fails * 100 / MPIDI_VCI_HYBRID_WINDOW;
+    mode = __atomic_load_n(&v->mode, __ATOMIC_RELAXED);
+    if (mode == MPIDI_VCI_HYBRID_TRYLOCK && pct >= v->high_pct)
+        mode = MPIDI_VCI_HYBRID_HANDOFF;
+    else if (mode == MPIDI_VCI_HYBRID_HANDOFF && pct <= v->low_pct)
+        mode = MPIDI_VCI_HYBRID_TRYLOCK;
+    else
+        return;
+    __atomic_store_n(&v->mode, mode, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&v->switches, 1, __ATOMIC_RELAXED);
+}
+
+/* Block on the lock after a missed trylock in TRYLOCK mode. */
+static inline void MPIDI_vci_hybrid_wait(MPIDI_vci_hybrid_t * v)
+{
+    MPIDI_VCI_HYBRID_CS_ENTER(v->mutex);
+}
+
+#endif /* CH4_VCI_HYBRID_H_INCLUDED */
@@ -0,0 +1,302 @@
+/* -*- Mode: C; c-basic-offset:4 ; indent-tabs-mode:nil ; -*- */
+/*
+ *  (C) 2019 by Argonne National Laboratory.
+ *      See COPYRIGHT in top-level directory.
+ */
+
+#ifndef CH4_VCI_MAP_H_INCLUDED
+#define CH4_VCI_MAP_H_INCLUDED
+
+/*
+ * Mapping of operations to VCIs. The policy is MPIR_CVAR_CH4_VCI_MAP:
+ *
+ *  comm    (default) one VCI per communicator, from its context id;
+ *  hash    sends go by a hash of (context id, destination rank, tag), so
+ *          one communicator spreads over all VCIs;
+ *  thread  every thread sends on one VCI, handed out round-robin on its
+ *          first send;
+ *  hint    the VCI given to the communicator with the info key "vci"
+ *          (MPIDI_vci_map_info_hint() from the info-set path; every rank
+ *          must set the same value), else the comm policy.
+ *
+ * A receive cannot know the VCI of a hashed send (wildcards) or of the
+ * sending thread, so receives always use the communicator's VCI, and
+ * hash and thread are only honoured with MPIR_CVAR_CH4_VCI_MAP_CROSS_MATCH=1,
+ * for a netmod whose receives match messages arriving on any VCI.
+ * Without it they fall back to comm, and rank 0 says so at init.
+ *
+ * MPIDI_vci_map_route() is the VCI ch4 routes an operation by, and
+ * MPIDI_vci_map_select() the same VCI counted once per operation.
+ *
+ * With MPIR_CVAR_CH4_VCI_MAP_STATS=1 every selection is counted per VCI,
+ * and MPIDI_vci_map_finalize(rank) prints the spread (to stderr, or
+ * appended to MPIR_CVAR_CH4_VCI_MAP_STATS_FILE): operations and share per
+ * VCI, and the max/mean imbalance.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define MPIDI_VCI_MAP_COMM   0
+#define MPIDI_VCI_MAP_HASH   1
+#define MPIDI_VCI_MAP_THREAD 2
+#define MPIDI_VCI_MAP_HINT   3
+
+#define MPIDI_VCI_MAP_SEND 0
+#define MPIDI_VCI_MAP_RECV 1
+
+#define MPIDI_VCI_MAP_MAX_VCIS   64     /* counted VCIs; more share the last slot */
+#define MPIDI_VCI_MAP_HINT_SLOTS 256    /* communicators with a hint, power of two */
+#define MPIDI_VCI_MAP_HINT_KEY   "vci"
+
+#define MPIDI_VCI_MAP_WEAK __attribute__((weak))
+
+/* hint table entry; key is context_id + 1, 0 if free, -1 if deleted */
+typedef struct MPIDI_vci_map_hint {
+    int key;
+    int vci;
+} MPIDI_vci_map_hint_t;
+
+typedef struct MPIDI_vci_map_counter {
+    uint64_t ops;
+} __attribute__((aligned(64))) MPIDI_vci_map_counter_t;
+
+typedef struct MPIDI_vci_map_global {
+    int ready;
+    int nvcis;
+    int policy;
+    int requested;              /* policy of the CVAR, before a fallback */
+    int cross_match;
+    int stats;
+    uint32_t next_thread;
+    MPIDI_vci_map_hint_t hints[MPIDI_VCI_MAP_HINT_SLOTS];
+    MPIDI_vci_map_counter_t counters[MPIDI_VCI_MAP_MAX_VCIS];
+} MPIDI_vci_map_global_t;
+
+MPIDI_VCI_MAP_WEAK MPIDI_vci_map_global_t MPIDI_vci_map_global = { .nvcis = 1 };
+MPIDI_VCI_MAP_WEAK __thread int MPIDI_vci_map_thread_vci = -1;
+
+static const char *const MPIDI_vci_map_names[] = { "comm", "hash", "thread", "hint" };
+
+static inline int MPIDI_vci_map_parse(const char *name)
+{
+    if (strcmp(name, "hash") == 0)
+        return MPIDI_VCI_MAP_HASH;
+    if (strcmp(name, "thread") == 0)
+        return MPIDI_VCI_MAP_THREAD;
+    if (strcmp(name, "hint") == 0)
+        return MPIDI_VCI_MAP_HINT;
+    return MPIDI_VCI_MAP_COMM;
+}
+
+/* Read the CVARs on the first call; ch4 routes operations during MPI_Init,
+ * before the init hook, so the caller may run it early with rank -1.
+ * Rank 0 warns about a policy that fell back to comm. */
+static inline int MPIDI_vci_map_init(int nvcis, int rank)
+{
+    MPIDI_vci_map_global_t *g = &MPIDI_vci_map_global;
+    const char *env;
+
+    if (!g->ready) {
+        memset(g, 0, sizeof(*g));
+        g->nvcis = nvcis > 0 ? nvcis : 1;
+        g->requested = MPIDI_VCI_MAP_COMM;
+        if ((env = getenv("MPIR_CVAR_CH4_VCI_MAP")) != NULL)
+            g->requested = MPIDI_vci_map_parse(env);
+        if ((env = getenv("MPIR_CVAR_CH4_VCI_MAP_CROSS_MATCH")) != NULL)
+            g->cross_match = atoi(env);
+        if ((env = getenv("MPIR_CVAR_CH4_VCI_MAP_STATS")) != NULL)
+            g->stats = atoi(env);
+        /* receives would miss messages sent on another VCI */
+        g->policy = g->requested;
+        if (!g->cross_match &&
+            (g->policy == MPIDI_VCI_MAP_HASH || g->policy == MPIDI_VCI_MAP_THREAD))
+            g->policy = MPIDI_VCI_MAP_COMM;
+        g->ready = 1;
+    }
+    if (rank == 0 && g->policy != g->requested)
+        fprintf(stderr, "MPIR_CVAR_CH4_VCI_MAP=%s needs MPIR_CVAR_CH4_VCI_MAP_CROSS_MATCH=1, "
+                "using comm\n", MPIDI_vci_map_names[g->requested]);
+    return 0;
+}
+
+/* Context ids differ only in a few bits; spread them before the modulo. */
+static inline uint32_t MPIDI_vci_map_mix(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline int MPIDI_vci_map_hint_lookup(int context_id)
+{
+    MPIDI_vci_map_hint_t *hints = MPIDI_vci_map_global.hints;
+    uint32_t i, slot = MPIDI_vci_map_mix((uint32_t) context_id);
+    int key;
+
+    for (i = 0; i < MPIDI_VCI_MAP_HINT_SLOTS; i++, slot++) {
+        MPIDI_vci_map_hint_t *h = &hints[slot & (MPIDI_VCI_MAP_HINT_SLOTS - 1)];
+        key = __atomic_load_n(&h->key, __ATOMIC_ACQUIRE);
+        if (key == context_id + 1)
+            return h->vci;
+        if (key == 0)
+            break;
+    }
+    return -1;
+}
+
+/* Record vci for the communicator; vci < 0 removes its hint. Called
+ * when its info is set, before it carries traffic, and with -1 when it
+ * is freed, as context ids are reused. Returns 0, or -1 if the table is
+ * full. */
+static inline int MPIDI_vci_map_set_hint(int context_id, int vci)
+{
+    MPIDI_vci_map_hint_t *hints = MPIDI_vci_map_global.hints;
+    MPIDI_vci_map_hint_t *h, *free_slot = NULL;
+    uint32_t i, slot = MPIDI_vci_map_mix((uint32_t) context_id);
+
+    for (i = 0; i < MPIDI_VCI_MAP_HINT_SLOTS; i++, slot++) {
+        h = &hints[slot & (MPIDI_VCI_MAP_HINT_SLOTS - 1)];
+        if (h->key == context_id + 1) {
+            if (vci < 0)
+                __atomic_store_n(&h->key, -1, __ATOMIC_RELEASE);
+            else
+                __atomic_store_n(&h->vci, vci % MPIDI_vci_map_global.nvcis, __ATOMIC_RELEASE);
+            return 0;
+        }
+        if (h->key <= 0 && free_slot == NULL)
+            free_slot = h;
+        if (h->key == 0)
+            break;
+    }
+    if (vci < 0)
+        return 0;
+    if (free_slot == NULL)
+        return -1;
+    free_slot->vci = vci % MPIDI_vci_map_global.nvcis;
+    __atomic_store_n(&free_slot->key, context_id + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Info hint hook: consumes key "vci" with a non-negative integer value.
+ * Returns 1 if the key was ours. */
+static inline int MPIDI_vci_map_info_hint(int context_id, const char *key, const char *value)
+{
+    char *end;
+    long vci;
+
+    if (strcmp(key, MPIDI_VCI_MAP_HINT_KEY) != 0)
+        return 0;
+    vci = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || vci < 0)
+        vci = -1;
+    MPIDI_vci_map_set_hint(context_id, (int) vci);
+    return 1;
+}
+
+static inline int MPIDI_vci_map_comm(int context_id)
+{
+    return (int) (MPIDI_vci_map_mix((uint32_t) context_id) % (uint32_t) MPIDI_vci_map_global.nvcis);
+}
+
+static inline int MPIDI_vci_map_hash(int context_id, int rank, int tag)
+{
+    uint32_t h = MPIDI_vci_map_mix((uint32_t) tag);
+    h = MPIDI_vci_map_mix((uint32_t) rank ^ h);
+    h = MPIDI_vci_map_mix((uint32_t) context_id ^ h);
+    return (int) (h % (uint32_t) MPIDI_vci_map_global.nvcis);
+}
+
+/* VCI of a send (dir MPIDI_VCI_MAP_SEND, rank is the destination) or a
+ * receive (MPIDI_VCI_MAP_RECV, rank is the source) of communicator
+ * context_id, not counted. */
+static inline int MPIDI_vci_map_route(int context_id, int rank, int tag, int dir)
+{
+    MPIDI_vci_map_global_t *g = &MPIDI_vci_map_global;
+    int vci, policy = g->policy;
+
+    if (dir == MPIDI_VCI_MAP_RECV && policy != MPIDI_VCI_MAP_HINT)
+        policy = MPIDI_VCI_MAP_COMM;
+
+    switch (policy) {
+        case MPIDI_VCI_MAP_HASH:
+            vci = MPIDI_vci_map_hash(context_id, rank, tag);
+            break;
+
+        case MPIDI_VCI_MAP_THREAD:
+            vci = MPIDI_vci_map_thread_vci;
+            if (__builtin_expect(vci < 0, 0)) {
+                vci = (int) (__atomic_fetch_add(&g->next_thread, 1, __ATOMIC_RELAXED) %
+                             (uint32_t) g->nvcis);
+                MPIDI_vci_map_thread_vci = vci;
+            }
+            break;
+
+        case MPIDI_VCI_MAP_HINT:
+            vci = MPIDI_vci_map_hint_lookup(context_id);
+            if (vci < 0)
+                vci = MPIDI_vci_map_comm(context_id);
+            break;
+
+        default:
+            vci = MPIDI_vci_map_comm(context_id);
+            break;
+    }
+    return vci;
+}
+
+/* MPIDI_vci_map_route(), counted with MPIR_CVAR_CH4_VCI_MAP_STATS=1 */
+static inline int MPIDI_vci_map_select(int context_id, int rank, int tag, int dir)
+{
+    MPIDI_vci_map_global_t *g = &MPIDI_vci_map_global;
+    int vci = MPIDI_vci_map_route(context_id, rank, tag, dir);
+
+    if (g->stats) {
+        int slot = vci < MPIDI_VCI_MAP_MAX_VCIS ? vci : MPIDI_VCI_MAP_MAX_VCIS - 1;
+        __atomic_fetch_add(&g->counters[slot].ops, 1, __ATOMIC_RELAXED);
+    }
+    return vci;
+}
+
+/* Print the spread if counting was on, and reset the counters. */
+static inline int MPIDI_vci_map_finalize(int rank)
+{
+    MPIDI_vci_map_global_t *g = &MPIDI_vci_map_global;
+    const char *path;
+    FILE *out;
+    uint64_t total = 0, max = 0;
+    int vci, nslots, used = 0;
+
+    if (!g->stats)
+        return 0;
+    nslots = g->nvcis < MPIDI_VCI_MAP_MAX_VCIS ? g->nvcis : MPIDI_VCI_MAP_MAX_VCIS;
+    for (vci = 0; vci < nslots; vci++) {
+        uint64_t ops = g->counters[vci].ops;
+        total += ops;
+        max = ops > max ? ops : max;
+        used += ops != 0;
+    }
+    path = getenv("MPIR_CVAR_CH4_VCI_MAP_STATS_FILE");
+    out = (path && *path) ? fopen(path, "a") : NULL;
+    if (out == NULL)
+        out = stderr;
+
+    fprintf(out, "%5s %6s %12s %7s\n", "rank", "vci", "ops", "share");
+    for (vci = 0; vci < nslots; vci++)
+        fprintf(out, "%5d %6d %12lu %6.1f%%\n", rank, vci, (unsigned long) g->counters[vci].ops,
+                total ? 100.0 * g->counters[vci].ops / total : 0.0);
+    fprintf(out, "%5d policy %s: %lu ops on %d of %d vcis, max/mean %.2f\n", rank,
+            MPIDI_vci_map_names[g->policy], (unsigned long) total, used, g->nvcis,
+            total ? (double) max * nslots / total : 0.0);
+    if (out != stderr)
+        fclose(out);
+    memset(g->counters, 0, sizeof(g->counters));
+    return 0;
+}
+
+#endif /* CH4_VCI_MAP_H_INCLUDED */
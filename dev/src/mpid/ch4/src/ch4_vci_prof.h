@@ -0,0 +1,270 @@
+/* -*- Mode: C; c-basic-offset:4 ; indent-tabs-mode:nil ; -*- */
+/*
+ *  (C) 2019 by Argonne National Laboratory.
+ *      See COPYRIGHT in top-level directory.
+ */
+
+#ifndef CH4_VCI_PROF_H_INCLUDED
+#define CH4_VCI_PROF_H_INCLUDED
+
+/*
+ * Per-VCI critical-section contention profiler, compiled in with
+ * -DMPIDI_CH4_VCI_PROFILE (installMPICH.sh -v) and a no-op otherwise.
+ *
+ * For every VCI and every call site that enters its critical section it
+ * counts acquisitions, failed trylocks, operations handed off to the
+ * current owner, and rdtsc cycles spent waiting for and holding the lock.
+ * A site is the file:line of the MPIDI_VCI_PROF_ACQUIRED() that took the
+ * lock. MPIDI_VCI_PROF_FINALIZE(rank) prints the table to stderr, or
+ * appends it to MPIR_CVAR_CH4_VCI_PROFILE_FILE if set.
+ *
+ * Usage around a per-VCI critical section:
+ *
+ *     MPIDI_VCI_PROF_WAIT_BEGIN(vci);
+ *     if (trylock fails) {
+ *         MPIDI_VCI_PROF_TRYLOCK_FAILED(vci);
+ *         ... hand the operation to the owner:  MPIDI_VCI_PROF_HANDOFF(vci);
+ *         ... or block on the lock, then:       MPIDI_VCI_PROF_ACQUIRED(vci);
+ *     } else
+ *         MPIDI_VCI_PROF_ACQUIRED(vci);
+ *     ...
+ *     MPIDI_VCI_PROF_RELEASE(vci);
+ *
+ * ch4_dev_hooks.h wraps MPID_THREAD_SAFE_BEGIN/END this way, VCIs being
+ * numbered by their mutex, and prints the table from MPID_Finalize.
+ *
+ * The report ends each VCI with a hint: on a VCI where more than
+ * MPIDI_VCI_PROF_HANDOFF_FAIL_RATE of the trylocks fail, handing work to
+ * the owner beats retrying the lock.
+ */
+
+#ifdef MPIDI_CH4_VCI_PROFILE
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "rdtsc.h"
+
+#define MPIDI_VCI_PROF_MAX_VCIS  64     /* VCIs beyond this share the last slot */
+#define MPIDI_VCI_PROF_MAX_SITES 64     /* site 0 collects any overflow */
+#define MPIDI_VCI_PROF_HANDOFF_FAIL_RATE 0.25   /* failed / attempted trylocks */
+
+#define MPIDI_VCI_PROF_WEAK __attribute__((weak))
+
+typedef struct MPIDI_vci_prof_counters {
+    uint64_t acquires;
+    uint64_t trylock_fails;
+    uint64_t handoffs;
+    uint64_t wait_cycles;
+    uint64_t hold_cycles;
+} MPIDI_vci_prof_counters_t;
+
+typedef struct MPIDI_vci_prof_site {
+    const char *file;
+    int line;
+} MPIDI_vci_prof_site_t;
+
+typedef struct MPIDI_vci_prof_global {
+    pthread_mutex_t site_lock;
+    int nsites;
+    MPIDI_vci_prof_site_t sites[MPIDI_VCI_PROF_MAX_SITES];
+    MPIDI_vci_prof_counters_t counters[MPIDI_VCI_PROF_MAX_VCIS][MPIDI_VCI_PROF_MAX_SITES];
+} MPIDI_vci_prof_global_t;
+
+/* what the calling thread is doing with each VCI */
+typedef struct MPIDI_vci_prof_thread {
+    uint64_t wait_start[MPIDI_VCI_PROF_MAX_VCIS];
+    uint64_t hold_start[MPIDI_VCI_PROF_MAX_VCIS];
+    int hold_site[MPIDI_VCI_PROF_MAX_VCIS];
+} MPIDI_vci_prof_thread_t;
+
+MPIDI_VCI_PROF_WEAK MPIDI_vci_prof_global_t MPIDI_vci_prof_global = {
+    .site_lock = PTHREAD_MUTEX_INITIALIZER,
+    .nsites = 1,
+    .sites = {{"(other)", 0}},
+};
+MPIDI_VCI_PROF_WEAK __thread MPIDI_vci_prof_thread_t MPIDI_vci_prof_thread;
+
+static inline int MPIDI_vci_prof_slot(int vci)
+{
+    return vci < MPIDI_VCI_PROF_MAX_VCIS ? vci : MPIDI_VCI_PROF_MAX_VCIS - 1;
+}
+
+/* Index of the site file:line, registered on first use. Called once per
+ * call site and translation unit, so a mutex is fine. */
+static inline int MPIDI_vci_prof_site(const char *file, int line)
+{
+    MPIDI_vci_prof_global_t *g = &MPIDI_vci_prof_global;
+    int i;
+
+    pthread_mutex_lock(&g->site_lock);
+    for (i = 1; i < g->nsites; i++)
+        if (g->sites[i].line == line && strcmp(g->sites[i].file, file) == 0)
+            break;
+    if (i == g->nsites) {
+        if (g->nsites < MPIDI_VCI_PROF_MAX_SITES) {
+            g->sites[i].file = file;
+            g->sites[i].line = line;
+            g->nsites++;
+        } else {
+            i = 0;
+        }
+    }
+    pthread_mutex_unlock(&g->site_lock);
+    return i;
+}
+
+static inline void MPIDI_vci_prof_add(uint64_t * counter, uint64_t value)
+{
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline void MPIDI_vci_prof_wait_begin(int vci)
+{
+    MPIDI_vci_prof_thread.wait_start[MPIDI_vci_prof_slot(vci)] = rdtsc();
+}
+
+static inline void MPIDI_vci_prof_acquired(int vci, int site)
+{
+    int slot = MPIDI_vci_prof_slot(vci);
+    MPIDI_vci_prof_counters_t *c = &MPIDI_vci_prof_global.counters[slot][site];
+    uint64_t now = rdtsc();
+    uint64_t start = MPIDI_vci_prof_thread.wait_start[slot];
+
+    MPIDI_vci_prof_add(&c->acquires, 1);
+    if (start && now > start)
+        MPIDI_vci_prof_add(&c->wait_cycles, now - start);
+    MPIDI_vci_prof_thread.wait_start[slot] = 0;
+    MPIDI_vci_prof_thread.hold_start[slot] = now;
+    MPIDI_vci_prof_thread.hold_site[slot] = site;
+}
+
+static inline void MPIDI_vci_prof_trylock_failed(int vci, int site)
+{
+    int slot = MPIDI_vci_prof_slot(vci);
+    MPIDI_vci_prof_add(&MPIDI_vci_prof_global.counters[slot][site].trylock_fails, 1);
+}
+
+/* The operation was queued for the owner: the wait ends here. */
+static inline void MPIDI_vci_prof_handoff(int vci, int site)
+{
+    int slot = MPIDI_vci_prof_slot(vci);
+    MPIDI_vci_prof_counters_t *c = &MPIDI_vci_prof_global.counters[slot][site];
+    uint64_t start = MPIDI_vci_prof_thread.wait_start[slot];
+    uint64_t now = rdtsc();
+
+    MPIDI_vci_prof_add(&c->handoffs, 1);
+    if (start && now > start)
+        MPIDI_vci_prof_add(&c->wait_cycles, now - start);
+    MPIDI_vci_prof_thread.wait_start[slot] = 0;
+}
+
+static inline void MPIDI_vci_prof_release(int vci)
+{
+    int slot = MPIDI_vci_prof_slot(vci);
+    uint64_t start = MPIDI_vci_prof_thread.hold_start[slot];
+    uint64_t now = rdtsc();
+
+    if (start && now > start)
+        MPIDI_vci_prof_add(&MPIDI_vci_prof_global.counters[slot]
+                           [MPIDI_vci_prof_thread.hold_site[slot]].hold_cycles, now - start);
+    MPIDI_vci_prof_thread.hold_start[slot] = 0;
+}
+
+static inline void MPIDI_vci_prof_print_row(FILE * out, int rank, const char *vci,
+                                            const char *site, const MPIDI_vci_prof_counters_t * c,
+                                            double ns_per_tick, const char *hint)
+{
+    /* a wait ends in either an acquisition or a handoff */
+    double waits = c->acquires + c->handoffs ? (double) (c->acquires + c->handoffs) : 1.0;
+    double acq = c->acquires ? (double) c->acquires : 1.0;
+    fprintf(out, "%5d %6s %-32s %10lu %10lu %10lu %10.0f %10.0f %s\n", rank, vci, site,
+            (unsigned long) c->acquires, (unsigned long) c->trylock_fails,
+            (unsigned long) c->handoffs, c->wait_cycles * ns_per_tick / waits,
+            c->hold_cycles * ns_per_tick / acq, hint);
+}
+
+/* Print the table and reset the counters. */
+static inline int MPIDI_vci_prof_finalize(int rank)
+{
+    MPIDI_vci_prof_global_t *g = &MPIDI_vci_prof_global;
+    const char *path = getenv("MPIR_CVAR_CH4_VCI_PROFILE_FILE");
+    FILE *out = (path && *path) ? fopen(path, "a") : NULL;
+    double ns_per_tick;
+    int vci, site;
+
+    if (out == NULL)
+        out = stderr;
+    rdtsc_calibrate();
+    ns_per_tick = rdtsc_ns_per_tick;
+
+    fprintf(out, "%5s %6s %-32s %10s %10s %10s %10s %10s %s\n", "rank", "vci", "site",
+            "acquires", "tryfails", "handoffs", "wait(ns)", "hold(ns)", "hint");
+    for (vci = 0; vci < MPIDI_VCI_PROF_MAX_VCIS; vci++) {
+        MPIDI_vci_prof_counters_t total;
+        char vci_name[16], site_name[64];
+        const char *hint;
+        uint64_t attempts;
+
+        memset(&total, 0, sizeof(total));
+        for (site = 0; site < g->nsites; site++) {
+            MPIDI_vci_prof_counters_t *c = &g->counters[vci][site];
+            if (!c->acquires && !c->trylock_fails && !c->handoffs)
+                continue;
+            total.acquires += c->acquires;
+            total.trylock_fails += c->trylock_fails;
+            total.handoffs += c->handoffs;
+            total.wait_cycles += c->wait_cycles;
+            total.hold_cycles += c->hold_cycles;
+            snprintf(vci_name, sizeof(vci_name), "%d", vci);
+            snprintf(site_name, sizeof(site_name), "%s:%d", g->sites[site].file,
+                     g->sites[site].line);
+            MPIDI_vci_prof_print_row(out, rank, vci_name, site_name, c, ns_per_tick, "");
+        }
+        if (!total.acquires && !total.trylock_fails && !total.handoffs)
+            continue;
+
+        /* every trylock either failed or ended in an acquisition */
+        attempts = total.acquires + total.trylock_fails;
+        if (total.trylock_fails > MPIDI_VCI_PROF_HANDOFF_FAIL_RATE * attempts)
+            hint = "contended: prefer handoff";
+        else
+            hint = "uncontended: prefer trylock";
+        snprintf(vci_name, sizeof(vci_name), "%d", vci);
+        MPIDI_vci_prof_print_row(out, rank, vci_name, "(all sites)", &total, ns_per_tick, hint);
+    }
+    if (out != stderr)
+        fclose(out);
+    memset(g->counters, 0, sizeof(g->counters));
+    return 0;
+}
+
+#define MPIDI_VCI_PROF_SITE_(fn, vci)                                    \
+    do {                                                                \
+        static int site_ = -1;                                          \
+        if (site_ < 0)                                                  \
+            site_ = MPIDI_vci_prof_site(__FILE__, __LINE__);            \
+        fn(vci, site_);                                                 \
+    } while (0)
+
+#define MPIDI_VCI_PROF_WAIT_BEGIN(vci)     MPIDI_vci_prof_wait_begin(vci)
+#define MPIDI_VCI_PROF_ACQUIRED(vci)       MPIDI_VCI_PROF_SITE_(MPIDI_vci_prof_acquired, vci)
+#define MPIDI_VCI_PROF_TRYLOCK_FAILED(vci) MPIDI_VCI_PROF_SITE_(MPIDI_vci_prof_trylock_failed, vci)
+#define MPIDI_VCI_PROF_HANDOFF(vci)        MPIDI_VCI_PROF_SITE_(MPIDI_vci_prof_handoff, vci)
+#define MPIDI_VCI_PROF_RELEASE(vci)        MPIDI_vci_prof_release(vci)
+#define MPIDI_VCI_PROF_FINALIZE(rank)      MPIDI_vci_prof_finalize(rank)
+
+#else
+
+#define MPIDI_VCI_PROF_WAIT_BEGIN(vci)     do { (void) (vci); } while (0)
+#define MPIDI_VCI_PROF_ACQUIRED(vci)       do { (void) (vci); } while (0)
+#define MPIDI_VCI_PROF_TRYLOCK_FAILED(vci) do { (void) (vci); } while (0)
+#define MPIDI_VCI_PROF_HANDOFF(vci)        do { (void) (vci); } while (0)
+#define MPIDI_VCI_PROF_RELEASE(vci)        do { (void) (vci); } while (0)
+#define MPIDI_VCI_PROF_FINALIZE(rank)      do { (void) (rank); } while (0)
+
+#endif /* MPIDI_CH4_VCI_PROFILE */
+
+#endif /* CH4_VCI_PROF_H_INCLUDED */
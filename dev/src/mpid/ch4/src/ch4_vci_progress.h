@@ -0,0 +1,294 @@
+/* -*- Mode: C; c-basic-offset:4 ; indent-tabs-mode:nil ; -*- */
+/*
+ *  (C) 2019 by Argonne National Laboratory.
+ *      See COPYRIGHT in top-level directory.
+ */
+
+#ifndef CH4_VCI_PROGRESS_H_INCLUDED
+#define CH4_VCI_PROGRESS_H_INCLUDED
+
+/*
+ * Per-VCI asynchronous progress threads, compiled in with
+ * -DMPIDI_CH4_VCI_PROGRESS (installMPICH.sh -a), instead of the single
+ * global thread of MPIR_CVAR_ASYNC_PROGRESS.
+ *
+ * MPIDI_vci_progress_start() spawns MPIR_CVAR_CH4_VCI_PROGRESS_THREADS
+ * threads (default: one per VCI, 0 disables); thread t serves VCIs t,
+ * t + nthreads, ... Each one is bound with hwloc to one core of
+ * MPIR_CVAR_CH4_VCI_PROGRESS_CORES, a list of logical core indices such
+ * as "4-7,12" (default: the last cores of the node), round-robin.
+ *
+ * A progress thread calls the poll function given to
+ * MPIDI_vci_progress_start() for each of its VCIs without holding any
+ * lock (ch4's progress takes the VCI lock itself and dispatches the
+ * work handed to ch4's work queue), so it is the natural owner the
+ * posting threads hand off to. When no handoff woke it for MPIR_CVAR_CH4_VCI_PROGRESS_SPIN
+ * rounds (default 10000) it sleeps for up to
+ * MPIR_CVAR_CH4_VCI_PROGRESS_SLEEP_US microseconds (default 100); a
+ * handoff to one of its VCIs wakes it at once.
+ *
+ * ch4_dev_hooks.h starts the threads from MPID_InitCompleted if the
+ * application got MPI_THREAD_MULTIPLE (below it ch4's critical sections
+ * are no-ops), wakes them when an operation goes to ch4's work queue,
+ * and stops them at the start of MPID_Finalize. With per-VCI progress
+ * in ch4 (-DMPIDI_DEV_PROGRESS_VCI, installMPICH.sh -b) there is one
+ * thread per VCI of MPIR_CVAR_CH4_NUM_VCIS polling
+ * MPIDI_progress_test_vci(); a single-VNI ch4 gets one thread polling
+ * MPID_Progress_poke().
+ */
+
+#include "ch4_workq_pool.h"
+
+#ifdef MPIDI_CH4_VCI_PROGRESS
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <hwloc.h>
+
+#define MPIDI_VCI_PROGRESS_SPIN     10000
+#define MPIDI_VCI_PROGRESS_SLEEP_US 100
+
+#define MPIDI_VCI_PROGRESS_WEAK __attribute__((weak))
+
+/* polls the progress of one VCI; called without any VCI lock held */
+typedef int (*MPIDI_vci_progress_poll_fn) (int vci);
+
+typedef struct MPIDI_vci_progress_thread {
+    int index;
+    int sleeping;               /* the poster's wake-up test */
+    int signaled;               /* wake-up not yet seen by the thread */
+    int core;                   /* logical core index, -1 if unbound */
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} MPIDI_WORKQ_POOL_ALIGNED MPIDI_vci_progress_thread_t;
+
+typedef struct MPIDI_vci_progress_global {
+    int nthreads;
+    int nvcis;
+    int stop;
+    int spin;
+    int sleep_us;
+    MPIDI_vci_progress_poll_fn poll;
+    MPIDI_vci_progress_thread_t *threads;
+    hwloc_topology_t topo;
+} MPIDI_vci_progress_global_t;
+
+MPIDI_VCI_PROGRESS_WEAK MPIDI_vci_progress_global_t MPIDI_vci_progress_global;
+
+/* Wake the progress thread serving vci; called after a handoff to it. */
+static inline void MPIDI_vci_progress_wake(int vci)
+{
+    MPIDI_vci_progress_global_t *g = &MPIDI_vci_progress_global;
+    MPIDI_vci_progress_thread_t *t;
+
+    if (g->nthreads == 0)
+        return;
+    t = &g->threads[vci % g->nthreads];
+    /* flag the work, then see whether it went to sleep before the flag */
+    __atomic_store_n(&t->signaled, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&t->sleeping, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&t->mutex);
+        pthread_cond_signal(&t->cond);
+        pthread_mutex_unlock(&t->mutex);
+    }
+}
+
+/* Wake every progress thread, for work whose VCI is not known. */
+static inline void MPIDI_vci_progress_wake_all(void)
+{
+    int i;
+
+    for (i = 0; i < MPIDI_vci_progress_global.nthreads; i++)
+        MPIDI_vci_progress_wake(i);
+}
+
+static inline void MPIDI_vci_progress_sleep(MPIDI_vci_progress_thread_t * t)
+{
+    MPIDI_vci_progress_global_t *g = &MPIDI_vci_progress_global;
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (long) g->sleep_us * 1000;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+
+    pthread_mutex_lock(&t->mutex);
+    __atomic_store_n(&t->sleeping, 1, __ATOMIC_RELAXED);
+    /* pairs with the fence between signaled and sleeping in the waker */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&t->signaled, __ATOMIC_RELAXED) &&
+        !__atomic_load_n(&g->stop, __ATOMIC_RELAXED))
+        pthread_cond_timedwait(&t->cond, &t->mutex, &deadline);
+    __atomic_store_n(&t->sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&t->mutex);
+}
+
+static inline void MPIDI_vci_progress_bind(MPIDI_vci_progress_thread_t * t)
+{
+    hwloc_obj_t core;
+
+    if (t->core < 0)
+        return;
+    core = hwloc_get_obj_by_type(MPIDI_vci_progress_global.topo, HWLOC_OBJ_CORE, t->core);
+    if (core != NULL)
+        hwloc_set_cpubind(MPIDI_vci_progress_global.topo, core->cpuset, HWLOC_CPUBIND_THREAD);
+}
+
+static inline void *MPIDI_vci_progress_main(void *arg)
+{
+    MPIDI_vci_progress_thread_t *t = (MPIDI_vci_progress_thread_t *) arg;
+    MPIDI_vci_progress_global_t *g = &MPIDI_vci_progress_global;
+    int idle = 0, i;
+
+    MPIDI_vci_progress_bind(t);
+    while (!__atomic_load_n(&g->stop, __ATOMIC_RELAXED)) {
+        int busy = __atomic_exchange_n(&t->signaled, 0, __ATOMIC_RELAXED);
+
+        for (i = t->index; g->poll && i < g->nvcis; i += g->nthreads)
+            g->poll(i);
+        if (busy)
+            idle = 0;
+        else if (++idle >= g->spin) {
+            MPIDI_vci_progress_sleep(t);
+            idle = 0;
+        }
+    }
+    return NULL;
+}
+
+/* Pick the core of every thread: the configured set, or the last
+ * nthreads cores of the node. */
+static inline void MPIDI_vci_progress_place(void)
+{
+    MPIDI_vci_progress_global_t *g = &MPIDI_vci_progress_global;
+    const char *env = getenv("MPIR_CVAR_CH4_VCI_PROGRESS_CORES");
+    int ncores = hwloc_get_nbobjs_by_type(g->topo, HWLOC_OBJ_CORE);
+    hwloc_bitmap_t set = hwloc_bitmap_alloc();
+    int i, core, count = 0;
+
+    if (env == NULL || hwloc_bitmap_list_sscanf(set, env) < 0 || hwloc_bitmap_iszero(set)) {
+        hwloc_bitmap_zero(set);
+        for (i = 0; i < g->nthreads && i < ncores; i++)
+            hwloc_bitmap_set(set, (unsigned) (ncores - 1 - i));
+    }
+    hwloc_bitmap_foreach_begin(core, set)
+        if (core < ncores)
+            count++;
+    hwloc_bitmap_foreach_end();
+
+    for (i = 0; i < g->nthreads; i++) {
+        int n = count ? i % count : -1;
+
+        g->threads[i].core = -1;
+        hwloc_bitmap_foreach_begin(core, set)
+            if (core < ncores && n-- == 0)
+                g->threads[i].core = core;
+        hwloc_bitmap_foreach_end();
+    }
+    hwloc_bitmap_free(set);
+}
+
+/* Start the progress threads for nvcis VCIs, polling with poll (may be
+ * NULL). */
+static inline int MPIDI_vci_progress_start(int nvcis, MPIDI_vci_progress_poll_fn poll)
+{
+    MPIDI_vci_progress_global_t *g = &MPIDI_vci_progress_global;
+    const char *env;
+    int i;
+
+    memset(g, 0, sizeof(*g));
+    g->nthreads = nvcis;
+    if ((env = getenv("MPIR_CVAR_CH4_VCI_PROGRESS_THREADS")) != NULL && atoi(env) >= 0)
+        g->nthreads = atoi(env) < nvcis ? atoi(env) : nvcis;
+    if (g->nthreads == 0)
+        return 0;
+    g->spin = MPIDI_VCI_PROGRESS_SPIN;
+    if ((env = getenv("MPIR_CVAR_CH4_VCI_PROGRESS_SPIN")) != NULL && atoi(env) > 0)
+        g->spin = atoi(env);
+    g->sleep_us = MPIDI_VCI_PROGRESS_SLEEP_US;
+    if ((env = getenv("MPIR_CVAR_CH4_VCI_PROGRESS_SLEEP_US")) != NULL && atoi(env) > 0)
+        g->sleep_us = atoi(env);
+    g->nvcis = nvcis;
+    g->poll = poll;
+    if (posix_memalign((void **) &g->threads, MPIDI_WORKQ_POOL_CACHELINE,
+                       g->nthreads * sizeof(MPIDI_vci_progress_thread_t))) {
+        g->nthreads = 0;
+        return -1;
+    }
+    memset(g->threads, 0, g->nthreads * sizeof(MPIDI_vci_progress_thread_t));
+
+    hwloc_topology_init(&g->topo);
+    hwloc_topology_load(g->topo);
+    MPIDI_vci_progress_place();
+
+    for (i = 0; i < g->nthreads; i++) {
+        MPIDI_vci_progress_thread_t *t = &g->threads[i];
+
+        t->index = i;
+        pthread_mutex_init(&t->mutex, NULL);
+        pthread_cond_init(&t->cond, NULL);
+        if (pthread_create(&t->thread, NULL, MPIDI_vci_progress_main, t)) {
+            g->nthreads = i;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Stop and join the progress threads. */
+static inline int MPIDI_vci_progress_stop(void)
+{
+    MPIDI_vci_progress_global_t *g = &MPIDI_vci_progress_global;
+    int i;
+
+    if (g->threads == NULL)
+        return 0;
+    __atomic_store_n(&g->stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < g->nthreads; i++) {
+        MPIDI_vci_progress_thread_t *t = &g->threads[i];
+
+        pthread_mutex_lock(&t->mutex);
+        pthread_cond_signal(&t->cond);
+        pthread_mutex_unlock(&t->mutex);
+        pthread_join(t->thread, NULL);
+        pthread_mutex_destroy(&t->mutex);
+        pthread_cond_destroy(&t->cond);
+    }
+    hwloc_topology_destroy(g->topo);
+    free(g->threads);
+    memset(g, 0, sizeof(*g));
+    return 0;
+}
+
+#else
+
+typedef int (*MPIDI_vci_progress_poll_fn) (int vci);
+
+static inline void MPIDI_vci_progress_wake(int vci)
+{
+    (void) vci;
+}
+
+static inline void MPIDI_vci_progress_wake_all(void)
+{
+}
+
+static inline int MPIDI_vci_progress_start(int nvcis, MPIDI_vci_progress_poll_fn poll)
+{
+    (void) nvcis;
+    (void) poll;
+    return 0;
+}
+
+static inline int MPIDI_vci_progress_stop(void)
+{
+    return 0;
+}
+
+#endif /* MPIDI_CH4_VCI_PROGRESS */
+
+#endif /* CH4_VCI_PROGRESS_H_INCLUDED */
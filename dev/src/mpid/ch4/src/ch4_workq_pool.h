@@ -0,0 +1,239 @@
+/* -*- Mode: C; c-basic-offset:4 ; indent-tabs-mode:nil ; -*- */
+/*
+ *  (C) 2019 by Argonne National Laboratory.
+ *      See COPYRIGHT in top-level directory.
+ */
+
+#ifndef CH4_WORKQ_POOL_H_INCLUDED
+#define CH4_WORKQ_POOL_H_INCLUDED
+
+/*
+ * Pool of ch4's work-queue elements in the handoff and hybrid builds.
+ * installMPICH.sh (hookDevWorkq) patches ch4_workq.h to allocate its
+ * elements with MPIDI_workq_pool_malloc() and free them with
+ * MPIDI_workq_pool_free(), and to drain the queue through
+ * MPIDI_WORKQ_POOL_DEQUEUE(). A thread that cannot enter a VCI allocates
+ * the element; the VCI owner dispatches and frees it. Allocation and
+ * release never call malloc/free once the pools are warm:
+ *
+ *  - every thread allocates from its own pool, a free list only it
+ *    touches;
+ *  - an owner releasing descriptors of other threads collects them per
+ *    origin pool and returns each run with a single CAS
+ *    (MPIDI_WORKQ_POOL_RETURN_BATCH at most, or at
+ *    MPIDI_workq_pool_flush(), which the drain calls when the queue is
+ *    empty);
+ *  - an empty pool takes back everything returned to it with a single
+ *    exchange, and only then carves a new chunk of
+ *    MPIDI_WORKQ_POOL_CHUNK descriptors.
+ *
+ * Elements larger than a descriptor's payload come from malloc.
+ * Descriptors are cache-line aligned and never freed before
+ * MPIDI_workq_pool_finalize(), which MPID_Finalize calls through
+ * ch4_dev_hooks.h in the instrumented and hybrid builds (a plain
+ * handoff build keeps them until exit), so a stale pointer never
+ * reaches the allocator. Descriptors returned to the pool of a thread
+ * that has exited stay there until finalize.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MPIDI_WORKQ_POOL_CACHELINE    64
+#define MPIDI_WORKQ_POOL_CHUNK        64        /* descriptors per refill */
+#define MPIDI_WORKQ_POOL_RETURN_BATCH 32        /* descriptors per return CAS */
+#define MPIDI_WORKQ_ITEM_PAYLOAD      160       /* bytes of a work-queue element */
+
+#define MPIDI_WORKQ_POOL_WEAK    __attribute__((weak))
+#define MPIDI_WORKQ_POOL_ALIGNED __attribute__((aligned(MPIDI_WORKQ_POOL_CACHELINE)))
+
+struct MPIDI_workq_pool;
+
+/* The work-queue element lives in payload. */
+typedef struct MPIDI_workq_item {
+    struct MPIDI_workq_item *next;      /* free list or return batch link */
+    struct MPIDI_workq_pool *pool;      /* pool the descriptor goes back to */
+    uint64_t payload[MPIDI_WORKQ_ITEM_PAYLOAD / sizeof(uint64_t)];
+} MPIDI_WORKQ_POOL_ALIGNED MPIDI_workq_item_t;
+
+typedef struct MPIDI_workq_pool {
+    MPIDI_workq_item_t *free_list;      /* owner thread only */
+    struct MPIDI_workq_pool *next_pool; /* registry, for finalize */
+    /* pushed to by other threads, taken whole by the owner */
+    MPIDI_workq_item_t *returned MPIDI_WORKQ_POOL_ALIGNED;
+} MPIDI_WORKQ_POOL_ALIGNED MPIDI_workq_pool_t;
+
+typedef struct MPIDI_workq_chunk {
+    struct MPIDI_workq_chunk *next;
+    MPIDI_workq_item_t items[MPIDI_WORKQ_POOL_CHUNK];
+} MPIDI_workq_chunk_t;
+
+/* descriptors of one foreign pool waiting to be returned */
+typedef struct MPIDI_workq_return_cache {
+    MPIDI_workq_pool_t *pool;
+    MPIDI_workq_item_t *head;
+    MPIDI_workq_item_t *tail;
+    int count;
+} MPIDI_workq_return_cache_t;
+
+typedef struct MPIDI_workq_pool_global {
+    MPIDI_workq_pool_t *pools;
+    MPIDI_workq_chunk_t *chunks;
+} MPIDI_workq_pool_global_t;
+
+/* weak, so the header works in every translation unit that includes it
+ * without build-system changes */
+MPIDI_WORKQ_POOL_WEAK MPIDI_workq_pool_global_t MPIDI_workq_pool_global;
+MPIDI_WORKQ_POOL_WEAK __thread MPIDI_workq_pool_t *MPIDI_workq_pool_tls;
+MPIDI_WORKQ_POOL_WEAK __thread MPIDI_workq_return_cache_t MPIDI_workq_return_tls;
+
+static inline MPIDI_workq_pool_t *MPIDI_workq_pool_create(void)
+{
+    MPIDI_workq_pool_t *pool;
+
+    if (posix_memalign((void **) &pool, MPIDI_WORKQ_POOL_CACHELINE, sizeof(*pool)))
+        return NULL;
+    memset(pool, 0, sizeof(*pool));
+    pool->next_pool = __atomic_load_n(&MPIDI_workq_pool_global.pools, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&MPIDI_workq_pool_global.pools, &pool->next_pool, pool,
+                                        1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+    MPIDI_workq_pool_tls = pool;
+    return pool;
+}
+
+/* Cold path of MPIDI_workq_item_alloc(): reclaim returns, else a new chunk. */
+static inline MPIDI_workq_item_t *MPIDI_workq_pool_refill(MPIDI_workq_pool_t * pool)
+{
+    MPIDI_workq_chunk_t *chunk;
+    int i;
+
+    pool->free_list = __atomic_exchange_n(&pool->returned, NULL, __ATOMIC_ACQUIRE);
+    if (pool->free_list)
+        return pool->free_list;
+
+    if (posix_memalign((void **) &chunk, MPIDI_WORKQ_POOL_CACHELINE, sizeof(*chunk)))
+        return NULL;
+    for (i = 0; i < MPIDI_WORKQ_POOL_CHUNK; i++) {
+        chunk->items[i].pool = pool;
+        chunk->items[i].next = (i + 1 < MPIDI_WORKQ_POOL_CHUNK) ? &chunk->items[i + 1] : NULL;
+    }
+    chunk->next = __atomic_load_n(&MPIDI_workq_pool_global.chunks, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&MPIDI_workq_pool_global.chunks, &chunk->next, chunk,
+                                        1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+    pool->free_list = &chunk->items[0];
+    return pool->free_list;
+}
+
+static inline MPIDI_workq_item_t *MPIDI_workq_item_alloc(void)
+{
+    MPIDI_workq_pool_t *pool = MPIDI_workq_pool_tls;
+    MPIDI_workq_item_t *item;
+
+    if (__builtin_expect(pool == NULL, 0) && (pool = MPIDI_workq_pool_create()) == NULL)
+        return NULL;
+    item = pool->free_list;
+    if (__builtin_expect(item == NULL, 0) && (item = MPIDI_workq_pool_refill(pool)) == NULL)
+        return NULL;
+    pool->free_list = item->next;
+    item->next = NULL;
+    return item;
+}
+
+/* Hand the collected run back to its pool. */
+static inline void MPIDI_workq_pool_flush(void)
+{
+    MPIDI_workq_return_cache_t *cache = &MPIDI_workq_return_tls;
+    MPIDI_workq_pool_t *pool = cache->pool;
+
+    if (cache->count == 0)
+        return;
+    cache->tail->next = __atomic_load_n(&pool->returned, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&pool->returned, &cache->tail->next, cache->head,
+                                        1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    cache->head = cache->tail = NULL;
+    cache->count = 0;
+}
+
+static inline void MPIDI_workq_item_release(MPIDI_workq_item_t * item)
+{
+    MPIDI_workq_return_cache_t *cache = &MPIDI_workq_return_tls;
+    MPIDI_workq_pool_t *pool = item->pool;
+
+    if (pool == MPIDI_workq_pool_tls) {
+        item->next = pool->free_list;
+        pool->free_list = item;
+        return;
+    }
+    if (cache->pool != pool || cache->count == MPIDI_WORKQ_POOL_RETURN_BATCH) {
+        MPIDI_workq_pool_flush();
+        cache->pool = pool;
+    }
+    item->next = cache->head;
+    cache->head = item;
+    if (cache->tail == NULL)
+        cache->tail = item;
+    cache->count++;
+}
+
+/* malloc() for ch4's work-queue elements. An element that does not fit
+ * the payload gets a descriptor of its own size, marked by a NULL pool. */
+static inline void *MPIDI_workq_pool_malloc(size_t size)
+{
+    MPIDI_workq_item_t *item;
+
+    if (size > sizeof(item->payload)) {
+        if (posix_memalign((void **) &item, MPIDI_WORKQ_POOL_CACHELINE,
+                           offsetof(MPIDI_workq_item_t, payload) + size))
+            return NULL;
+        item->pool = NULL;
+    } else if ((item = MPIDI_workq_item_alloc()) == NULL) {
+        return NULL;
+    }
+    return item->payload;
+}
+
+static inline void MPIDI_workq_pool_free(void *ptr)
+{
+    MPIDI_workq_item_t *item;
+
+    if (ptr == NULL)
+        return;
+    item = (MPIDI_workq_item_t *) ((char *) ptr - offsetof(MPIDI_workq_item_t, payload));
+    if (item->pool == NULL)
+        free(item);
+    else
+        MPIDI_workq_item_release(item);
+}
+
+/* Dequeue of ch4's drain loop: the elements it freed go back to their
+ * pools once the queue is empty. */
+#define MPIDI_WORKQ_POOL_DEQUEUE(q, pp)         \
+    do {                                        \
+        MPIDI_workq_dequeue(q, pp);             \
+        if (*(pp) == NULL)                      \
+            MPIDI_workq_pool_flush();           \
+    } while (0)
+
+/* Free every pool and descriptor. No thread may use the pools any more. */
+static inline void MPIDI_workq_pool_finalize(void)
+{
+    MPIDI_workq_chunk_t *chunk, *next_chunk;
+    MPIDI_workq_pool_t *pool, *next_pool;
+
+    for (chunk = MPIDI_workq_pool_global.chunks; chunk != NULL; chunk = next_chunk) {
+        next_chunk = chunk->next;
+        free(chunk);
+    }
+    for (pool = MPIDI_workq_pool_global.pools; pool != NULL; pool = next_pool) {
+        next_pool = pool->next_pool;
+        free(pool);
+    }
+    MPIDI_workq_pool_global.chunks = NULL;
+    MPIDI_workq_pool_global.pools = NULL;
+    MPIDI_workq_pool_tls = NULL;
+    memset(&MPIDI_workq_return_tls, 0, sizeof(MPIDI_workq_return_tls));
+}
+
+#endif /* CH4_WORKQ_POOL_H_INCLUDED */
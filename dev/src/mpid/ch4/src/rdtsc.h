@@ -1,6 +1,28 @@
 #ifndef __RDTSC_H_DEFINED__
 #define __RDTSC_H_DEFINED__
 
+#include <time.h>
+
+/*
+ * Cycle timer.
+ *
+ *   rdtsc()          raw tick counter, not ordered against other instructions
+ *   rdtsc_start()    tick counter read after all earlier instructions retired
+ *   rdtsc_stop()     tick counter read before any later instruction starts
+ *   rdtsc_invariant()  1 if ticks advance at a constant rate (safe to convert)
+ *   rdtsc_calibrate()  measure the tick rate; call once at startup to keep
+ *                      the cost out of timed regions
+ *   rdtsc_ticks_to_ns(), rdtsc_ns()
+ *
+ * Use rdtsc_start()/rdtsc_stop() around short intervals. The tick rate is
+ * measured once per process: the calibration state is defined weak, so
+ * every translation unit that includes this header shares it. If nobody
+ * called rdtsc_calibrate(), the first rdtsc_ticks_to_ns() or rdtsc_ns()
+ * does, which on x86 and PowerPC spins for RDTSC_CALIBRATION_NS (2 ms);
+ * the ARM generic timer reports its rate and needs no window. On targets
+ * without a user-readable counter the "ticks" are CLOCK_MONOTONIC
+ * nanoseconds.
+ */
 
 #if defined(__i386__)
 
@@ -10,6 +32,21 @@ static __inline__ unsigned long long rdtsc(void)
      __asm__ volatile (".byte 0x0f, 0x31" : "=A" (x));
      return x;
 }
+
+static __inline__ unsigned long long rdtsc_start(void)
+{
+  unsigned long long int x;
+     __asm__ volatile ("lfence\n\t.byte 0x0f, 0x31" : "=A" (x) :: "memory");
+     return x;
+}
+
+static __inline__ unsigned long long rdtsc_stop(void)
+{
+  unsigned long long int x;
+     __asm__ volatile (".byte 0x0f, 0x31\n\tlfence" : "=A" (x) :: "memory");
+     return x;
+}
+
 #elif defined(__x86_64__)
 
 static __inline__ unsigned long long rdtsc(void)
@@ -19,6 +56,21 @@ static __inline__ unsigned long long rdtsc(void)
   return ( (unsigned long long)lo)|( ((unsigned long long)hi)<<32 );
 }
 
+static __inline__ unsigned long long rdtsc_start(void)
+{
+  unsigned hi, lo;
+  __asm__ __volatile__ ("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+  return ( (unsigned long long)lo)|( ((unsigned long long)hi)<<32 );
+}
+
+/* rdtscp waits for earlier instructions; the lfence keeps later ones out */
+static __inline__ unsigned long long rdtsc_stop(void)
+{
+  unsigned hi, lo, aux;
+  __asm__ __volatile__ ("rdtscp\n\tlfence" : "=a"(lo), "=d"(hi), "=c"(aux) :: "memory");
+  return ( (unsigned long long)lo)|( ((unsigned long long)hi)<<32 );
+}
+
 #elif defined(__powerpc__)
 
 static __inline__ unsigned long long rdtsc(void)
@@ -41,12 +93,159 @@ static __inline__ unsigned long long rdtsc(void)
   return(result);
 }
 
+static __inline__ unsigned long long rdtsc_start(void)
+{
+  __asm__ volatile ("isync" ::: "memory");
+  return rdtsc();
+}
+
+static __inline__ unsigned long long rdtsc_stop(void)
+{
+  unsigned long long int x = rdtsc();
+  __asm__ volatile ("isync" ::: "memory");
+  return x;
+}
+
+#elif defined(__aarch64__)
+
+/* generic timer virtual count, constant rate given by cntfrq_el0 */
+static __inline__ unsigned long long rdtsc(void)
+{
+  unsigned long long x;
+  __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r"(x));
+  return x;
+}
+
+static __inline__ unsigned long long rdtsc_start(void)
+{
+  unsigned long long x;
+  __asm__ __volatile__ ("isb\n\tmrs %0, cntvct_el0" : "=r"(x) :: "memory");
+  return x;
+}
+
+static __inline__ unsigned long long rdtsc_stop(void)
+{
+  unsigned long long x;
+  __asm__ __volatile__ ("mrs %0, cntvct_el0\n\tisb" : "=r"(x) :: "memory");
+  return x;
+}
+
+#else
+
+#define RDTSC_USE_CLOCK_GETTIME
+
+static __inline__ unsigned long long rdtsc(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static __inline__ unsigned long long rdtsc_start(void)
+{
+  return rdtsc();
+}
+
+static __inline__ unsigned long long rdtsc_stop(void)
+{
+  return rdtsc();
+}
+
+#endif
+
+
+/* Whether tick deltas can be converted to time. On x86 this requires an
+ * invariant TSC (CPUID 0x80000007 EDX bit 8): constant rate across
+ * P-/C-states and in sync across cores. The PowerPC time base and the
+ * ARM generic timer are constant-rate by definition. */
+static __inline__ int rdtsc_invariant(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned eax, ebx, ecx, edx;
+  __asm__ __volatile__ ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000000u), "c"(0));
+  if (eax < 0x80000007u)
+    return 0;
+  __asm__ __volatile__ ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000007u), "c"(0));
+  return (edx >> 8) & 1;
+#else
+  return 1;
+#endif
+}
+
+#define RDTSC_CALIBRATION_NS 2000000 /* measurement window when the rate is not reported */
+
+#if defined(__GNUC__)
+#define RDTSC_WEAK __attribute__((weak))
 #else
+#define RDTSC_WEAK static /* no weak symbols: one calibration per file */
+#endif
 
-#error "No tick counter is available!"
+/* shared by every translation unit; 0.0 until calibrated */
+RDTSC_WEAK double rdtsc_ns_per_tick = 0.0;
+RDTSC_WEAK int rdtsc_is_invariant = -1;
+
+static __inline__ unsigned long long rdtsc_clock_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static __inline__ void rdtsc_calibrate(void)
+{
+  unsigned long long t0, t1, c0, c1;
 
+  if (rdtsc_ns_per_tick > 0.0)
+    return;
+  rdtsc_is_invariant = rdtsc_invariant();
+
+#if defined(RDTSC_USE_CLOCK_GETTIME)
+  rdtsc_ns_per_tick = 1.0;
+  return;
+#elif defined(__aarch64__)
+  {
+    unsigned long long freq;
+    __asm__ __volatile__ ("mrs %0, cntfrq_el0" : "=r"(freq));
+    if (freq) {
+      rdtsc_ns_per_tick = 1e9 / (double) freq;
+      return;
+    }
+  }
 #endif
 
+  /* Read the clock once before starting the counter and once before
+   * stopping it; over a window of RDTSC_CALIBRATION_NS the few nanoseconds
+   * between each clock read and its counter read do not matter. */
+  c0 = rdtsc_clock_ns();
+  t0 = rdtsc_start();
+  do {
+    c1 = rdtsc_clock_ns();
+  } while (c1 - c0 < RDTSC_CALIBRATION_NS);
+  t1 = rdtsc_stop();
+  if (t1 > t0)
+    rdtsc_ns_per_tick = (double)(c1 - c0) / (double)(t1 - t0);
+  else
+    rdtsc_ns_per_tick = 1.0;
+}
+
+static __inline__ double rdtsc_ticks_to_ns(unsigned long long ticks)
+{
+  if (rdtsc_ns_per_tick <= 0.0)
+    rdtsc_calibrate();
+  return (double) ticks * rdtsc_ns_per_tick;
+}
+
+/* Nanoseconds since an arbitrary origin. Falls back to CLOCK_MONOTONIC when
+ * the counter rate is not constant. */
+static __inline__ unsigned long long rdtsc_ns(void)
+{
+  if (rdtsc_ns_per_tick <= 0.0)
+    rdtsc_calibrate();
+  if (!rdtsc_is_invariant)
+    return rdtsc_clock_ns();
+  return (unsigned long long)((double) rdtsc() * rdtsc_ns_per_tick);
+}
+
 
 /*  $RCSfile:  $   $Author: kazutomo $
  *  $Revision: 1.6 $  $Date: 2005/04/13 18:49:58 $
@@ -45,7 +45,8 @@ Usage: sh installMpich.sh [Build Option] [Ad Options]
 
 Build MPICH option:
 	-g - global critical sections
-	-p [trylock, handoff] - per-vci critical section
+	-p [trylock, handoff, hybrid] - per-vci critical section, hybrid switches each vci
+	              between trylock and handoff by its trylock failure rate (needs -r)
 	-d - only download and unpack $CURRENT_MPICH_NAME from \"https://www.mpich.org/\"
 	
 Additional Options:
@@ -57,6 +58,16 @@ Additional Options:
 	              default branch is master \"https://github.com/pmodels/mpich\"
 	-i [yourPath] - additional installation path suffix to $INSTALLATION_PATH_PREFIX/{yourPath}/
 	-o - optimized installation build
+	-O - optimized build with LTO and profile-guided optimization: an instrumented
+	      build is trained with perftest-1.5 (pingpong, halo, allreduce,
+	      multithreaded message rate), then rebuilt with the profile; needs
+	      GCC 10 or later, a failed training step aborts
+	-t - compile in the CH4 event tracer of the ./dev overlay (use with -r)
+	-v - compile in the per-VCI lock contention profiler of the ./dev overlay (use with -r)
+	-m - route ch4's sends and receives by MPIR_CVAR_CH4_VCI_MAP of the ./dev overlay
+	      and count their VCIs (use with -r); sources with a single VCI only count
+	-a - per-VCI pinned async progress threads of the ./dev overlay instead of
+	      the global MPIR_CVAR_ASYNC_PROGRESS thread (needs -p hybrid)
 	-h - show this message
 	-l [logfile path] - MPICH configure and install logs will be print into this file
 	              it is installationLogs.txt by default
@@ -66,6 +77,9 @@ $USAGE_EXAMPLES
 "
 
 DEBUG_FLAGS="-g3 -gdwarf-2"
+EXTRA_CFLAGS="" # instrumentation switches for the ./dev overlay
+PGO_STAGE=""    # generate or use while building with -O
+PERFTEST_PATH=$(pwd)"/perftest-1.5"
 OSTYPE="$OSTYPE"
 SCRIPT_OSTYPE="$OSTYPE"
 
@@ -205,10 +219,154 @@ getMPICHSources() {
 
     eval "cd $CURRENT_MPICH_NAME"
     eval "cp -a ../../dev/. ./"
+    if devHooksNeeded; then
+      hookDevSources
+    fi
+    if test "$perVciType" = "handoff" || test "$perVciType" = "hybrid"; then
+      hookDevWorkq
+    fi
     eval "cd ../"
   fi
 }
 
+# The ./dev instrumentation (-t, -v, -m, -a, -p hybrid) needs hookDevSources
+devHooksNeeded() {
+  test -n "$EXTRA_CFLAGS" || test "$perVciType" = "hybrid"
+}
+
+# Add a line after (or, with a third argument, before) every line of the
+# ch4 sources matching the extended regex $1; stop if there is none
+hookDevSite() {
+  local files
+  local f
+
+  files=$(grep -rlE "$1" src/mpid/ch4)
+  if test -z "$files"; then
+    echo "$LOG_PREFIX No \"$1\" in the ch4 sources, can not hook the ./dev overlay"
+    exit 1
+  fi
+  for f in $files; do
+    awk -v pat="$1" -v hook="$2" -v before="$3" '
+      $0 ~ pat && before != "" { print hook }
+      { print }
+      $0 ~ pat && before == "" { print hook }' "$f" > "$f.tmp" && mv "$f.tmp" "$f"
+  done
+}
+
+# Patch the call sites of dev/src/mpid/ch4/src/ch4_dev_hooks.h into the
+# MPICH sources of the current directory
+hookDevSources() {
+  local csFile
+  local guardLine
+
+  if test -f ".dev_hooks"; then
+    echo "$LOG_PREFIX ./dev hooks already applied"
+    return 0
+  fi
+  echo "$LOG_PREFIX Hook ./dev overlay into ch4"
+
+  # wrap the per-VCI critical section
+  csFile=$(grep -rl "#define MPID_THREAD_SAFE_BEGIN(" src/mpid src/include |
+    grep -v "ch4_dev_hooks.h" | head -n 1)
+  if test -z "$csFile"; then
+    echo "$LOG_PREFIX No MPID_THREAD_SAFE_BEGIN in the MPICH sources, can not hook the ./dev overlay"
+    exit 1
+  fi
+  guardLine=$(grep -n "^#endif" "$csFile" | tail -n 1 | cut -d: -f1)
+  sed -e "s/#define MPID_THREAD_SAFE_BEGIN(/#define MPIDI_DEV_SAFE_BEGIN_ORIG(/" \
+    -e "s/#define MPID_THREAD_SAFE_END(/#define MPIDI_DEV_SAFE_END_ORIG(/" "$csFile" |
+    awk -v n="$guardLine" 'NR == n { print "#include \"ch4_dev_hooks.h\"" } { print }' \
+      > "$csFile.tmp" && mv "$csFile.tmp" "$csFile"
+
+  hookDevSite "ENTER[(]MPID_STATE_MPID_SEND[)]" "    MPIDI_DEV_HOOK_SEND(comm, rank, tag);"
+  hookDevSite "ENTER[(]MPID_STATE_MPID_ISEND[)]" "    MPIDI_DEV_HOOK_SEND(comm, rank, tag);"
+  hookDevSite "ENTER[(]MPID_STATE_MPID_RECV[)]" "    MPIDI_DEV_HOOK_RECV(comm, rank, tag);"
+  hookDevSite "ENTER[(]MPID_STATE_MPID_IRECV[)]" "    MPIDI_DEV_HOOK_RECV(comm, rank, tag);"
+  hookDevSite "EXIT[(]MPID_STATE_MPID_INITCOMPLETED[)]" "    MPIDI_DEV_HOOK_INIT();" before
+  hookDevSite "ENTER[(]MPID_STATE_MPID_FINALIZE[)]" "    MPIDI_DEV_HOOK_FINALIZE();"
+  case "$EXTRA_CFLAGS" in
+  *-DMPIDI_CH4_TRACE*)
+    hookDevSite "ENTER[(]MPID_STATE_(MPID_REQUEST_COMPLETE|MPIDI_CH4U_REQUEST_COMPLETE)[)]" \
+      "    MPIDI_DEV_HOOK_COMPLETE(req);"
+    hookDevSite "ENTER[(]MPID_STATE_(MPIDI_CH4U|MPIDIG)_DEQUEUE_(POSTED|UNEXP)[)]" \
+      "    MPIDI_DEV_HOOK_MATCH(rank, tag);"
+    ;;
+  esac
+  case "$EXTRA_CFLAGS" in
+  *-DMPIDI_CH4_VCI_MAP*)
+    hookDevVciMap
+    ;;
+  esac
+  touch ".dev_hooks"
+}
+
+# Route ch4 by dev/src/mpid/ch4/src/ch4_vci_map.h (-m): the communicator
+# hint hook reads the "vci" info key, and ch4's VCI choice MPIDI_get_vci
+# is renamed MPIDI_get_vci_ch4 behind a macro calling MPIDI_DEV_GET_VCI.
+# Sources with a single VCI have no choice to route; there -m only counts
+hookDevVciMap() {
+  local vciDef="^[A-Z_ ]*int MPIDI_get_vci[(]"
+  local vciFile
+
+  if grep -rqE "ENTER[(]MPID_STATE_MPID_COMM_SET_(HINTS|INFO)[)]" src/mpid/ch4; then
+    hookDevSite "ENTER[(]MPID_STATE_MPID_COMM_SET_(HINTS|INFO)[)]" \
+      "    MPIDI_DEV_HOOK_COMM_INFO(comm_ptr, info_ptr);"
+    hookDevSite "ENTER[(]MPID_STATE_MPID_COMM_FREE_HOOK[)]" "    MPIDI_DEV_HOOK_COMM_FREE(comm);"
+  else
+    echo "$LOG_PREFIX No communicator hint hook in ch4, the \"vci\" info key is not read"
+  fi
+
+  vciFile=$(grep -rlE "$vciDef" src/mpid/ch4 | head -n 1)
+  if test -z "$vciFile"; then
+    echo "$LOG_PREFIX No MPIDI_get_vci in ch4, -m only counts the VCI of each operation"
+    return 0
+  fi
+  awk -v pat="$vciDef" '$0 ~ pat {
+      print "#define MPIDI_get_vci(flag, comm, src_rank, dst_rank, tag) \\"
+      print "    MPIDI_DEV_GET_VCI(flag, comm, src_rank, dst_rank, tag)"
+      sub(/MPIDI_get_vci[(]/, "MPIDI_get_vci_ch4(")
+    }
+    { print }' "$vciFile" > "$vciFile.tmp" && mv "$vciFile.tmp" "$vciFile"
+}
+
+# Allocate ch4's work-queue elements from the descriptor pools of
+# dev/src/mpid/ch4/src/ch4_workq_pool.h (handoff and hybrid builds):
+# MPL_malloc/MPL_free, or the handle allocator of the element object,
+# become MPIDI_workq_pool_malloc/MPIDI_workq_pool_free, and the drain
+# loop dequeues through MPIDI_WORKQ_POOL_DEQUEUE, or MPIDI_DEV_WORKQ_DEQUEUE
+# of ch4_dev_hooks.h (batches and the hybrid drain cap) with the hooks
+hookDevWorkq() {
+  local workqFile="src/mpid/ch4/src/ch4_workq.h"
+  local header="ch4_workq_pool.h"
+  local dequeue="MPIDI_WORKQ_POOL_DEQUEUE"
+  local includeLine
+
+  if test -f ".dev_workq"; then
+    echo "$LOG_PREFIX ./dev work-queue pool already applied"
+    return 0
+  fi
+  if ! grep -qE "MPL_malloc[(]|MPIR_Handle_obj_alloc[(]&MPIDI_workq_elemt_mem" "$workqFile" ||
+    ! grep -q "MPIDI_workq_dequeue(&" "$workqFile"; then
+    echo "$LOG_PREFIX No work-queue allocation in $workqFile, can not hook the descriptor pools"
+    exit 1
+  fi
+  echo "$LOG_PREFIX Allocate ch4 work-queue elements from the ./dev descriptor pools"
+  if devHooksNeeded; then
+    header="ch4_dev_hooks.h"
+    dequeue="MPIDI_DEV_WORKQ_DEQUEUE"
+  fi
+
+  includeLine=$(grep -nE "^#include|^#define CH4_WORKQ_H_INCLUDED" "$workqFile" | tail -n 1 | cut -d: -f1)
+  sed -e "s/MPL_malloc(\([^,]*\), *[A-Z_]*)/MPIDI_workq_pool_malloc(\1)/" \
+    -e "s/MPL_free(/MPIDI_workq_pool_free(/" \
+    -e "s/MPIR_Handle_obj_alloc(&MPIDI_workq_elemt_mem)/MPIDI_workq_pool_malloc(sizeof(MPIDI_workq_elemt_t))/" \
+    -e "s/MPIR_Handle_obj_free(&MPIDI_workq_elemt_mem, */MPIDI_workq_pool_free(/" \
+    -e "s/MPIDI_workq_dequeue(&/$dequeue(\&/" "$workqFile" |
+    awk -v n="$includeLine" -v h="$header" '{ print } NR == n { print "#include \"" h "\"" }' \
+      > "$workqFile.tmp" && mv "$workqFile.tmp" "$workqFile"
+  touch ".dev_workq"
+}
+
 createMPICHDir() {
   if test ! -d "$MPICH_DIR_NAME"; then
     echo "$LOG_PREFIX Create MPICH directory"
@@ -271,22 +429,61 @@ initMPICHConfigureOpts() {
         --with-zm-prefix=embedded"
     ch4mt="--enable-ch4-mt=$1"
     ;;
+  hybrid)
+    # handoff build (izem queue) with the ./dev hybrid VCI switch, see
+    # dev/src/mpid/ch4/src/ch4_vci_hybrid.h
+    MPICH_PATH=$INSTALLATION_PATH_PREFIX$ADDITIONAL_INSTALLATION_PATH_SUFFIX"/per-vci-hybrid"
+    if test "$github" = false; then
+      threadCS="per-vni"
+    else
+      threadCS="per-vci"
+    fi
+    izemConfig="--enable-izem=queue \
+        --with-zm-prefix=embedded"
+    ch4mt="--enable-ch4-mt=handoff"
+    case "$EXTRA_CFLAGS" in
+    *-DMPIDI_CH4_MT_HYBRID*) ;;
+    *) EXTRA_CFLAGS="$EXTRA_CFLAGS -DMPIDI_CH4_MT_HYBRID" ;;
+    esac
+    if test "$github" = true; then
+      # the hybrid mode switch takes ch4's VCI critical section by name
+      case "$EXTRA_CFLAGS" in
+      *-DMPIDI_VCI_HYBRID_CS_NAME*) ;;
+      *) EXTRA_CFLAGS="$EXTRA_CFLAGS -DMPIDI_VCI_HYBRID_CS_NAME=VCI" ;;
+      esac
+    fi
+    ;;
   esac
 
   echo "$LOG_PREFIX Configure MPICH with $threadCS CS to $MPICH_PATH"
 
   removeOldInstallation "$MPICH_PATH"
 
+  local pgoFlags=""
+  LDFlags=""
+  if test -n "$PGO_STAGE"; then
+    # the embedded izem is configured with the same flags, so its queues
+    # and locks are trained and inlined together with ch4
+    pgoFlags=" -flto=auto -fprofile-dir=$PGO_PROFILE_DIR"
+    if test "$PGO_STAGE" = "generate"; then
+      pgoFlags="$pgoFlags -fprofile-generate -fprofile-update=atomic"
+    else
+      # sources the training never reached are reported by -Wmissing-profile
+      pgoFlags="$pgoFlags -fprofile-use"
+    fi
+    LDFlags="LDFLAGS=\"$pgoFlags\""
+  fi
+
   if test "$optimizedBuild" = true; then
-    CFlags="CFLAGS=-O3"
-    CXXFlags="CXXFLAGS=-O3"
+    CFlags="CFLAGS=\"-O3$pgoFlags$EXTRA_CFLAGS\""
+    CXXFlags="CXXFLAGS=\"-O3$pgoFlags\""
     performanceKeys="--enable-fast=O3,ndebug \
     --disable-error-checking \
     --without-timing \
     --without-mpit-pvars \
     --enable-g=none"
   else
-    CFlags="CFLAGS=\"$DEBUG_FLAGS\""
+    CFlags="CFLAGS=\"$DEBUG_FLAGS$EXTRA_CFLAGS\""
     CXXFlags="CXXFLAGS=\"$DEBUG_FLAGS\""
     performanceKeys="--enable-fast=O0 \
   --enable-timing=all \
@@ -302,6 +499,7 @@ initMPICHConfigureOpts() {
 
   MPICH_CONFIGURE_OPTS="$CFlags \
   $CXXFlags \
+  $LDFlags \
   --silent \
   --prefix=$MPICH_PATH \
   --with-hwloc=$INSTALLATION_PATH_PREFIX/hwloc \
@@ -320,11 +518,71 @@ makeAndInstall() {
   SECONDS=0
   echo "$LOG_PREFIX Make and install MPICH sources"
   make clean >> "$LOG_FILE_PATH"
-  make -j 7 >> "$LOG_FILE_PATH"
-  make install >> "$LOG_FILE_PATH"
+  if ! make -j 7 >> "$LOG_FILE_PATH" || ! make install >> "$LOG_FILE_PATH"; then
+    echo "$LOG_PREFIX MPICH make failed, see $LOG_FILE_PATH"
+    exit 1
+  fi
   showElapsedTime "MPICH installed"
 }
 
+# Run one PGO step, abort the installation if it fails
+pgoStep() {
+  if ! "$@" >> "$LOG_FILE_PATH" 2>&1; then
+    echo "$LOG_PREFIX PGO step failed: $*, see $LOG_FILE_PATH"
+    exit 1
+  fi
+}
+
+# Train the instrumented installation in $MPICH_PATH with perftest-1.5
+runPGOTraining() {
+  SECONDS=0
+  local trainDir
+  local mpiexec="$MPICH_PATH/bin/mpiexec"
+  trainDir="$(pwd)/pgo-perftest"
+
+  echo "$LOG_PREFIX Build perftest-1.5 for PGO training"
+  rm -rf "$trainDir"
+  cp -a "$PERFTEST_PATH/." "$trainDir/"
+  cd "$trainDir" || exit 1
+  pgoStep ./configure CC="$MPICH_PATH/bin/mpicc" --with-mpi="$MPICH_PATH"
+  pgoStep make mpptest goptest
+
+  echo "$LOG_PREFIX Run PGO training workloads"
+  # small-message pingpong
+  pgoStep "$mpiexec" -n 2 ./mpptest -quick -size 0 1024 64
+  # halo exchange
+  pgoStep "$mpiexec" -n 4 ./mpptest -quick -halo -size 0 8192 1024
+  # allreduce
+  pgoStep "$mpiexec" -n 4 ./goptest -dsum -size 8 1024 128
+  # message rate through the MPI_THREAD_MULTIPLE paths
+  pgoStep "$mpiexec" -n 2 ./mpptest -quick -threadmultiple -async -window 64 -size 8 256 8
+  cd ../ || exit 1
+
+  if test -z "$(find "$PGO_PROFILE_DIR" -name "*.gcda" 2>/dev/null | head -n 1)"; then
+    echo "$LOG_PREFIX PGO training wrote no profile to $PGO_PROFILE_DIR"
+    exit 1
+  fi
+  showElapsedTime "PGO training finished"
+}
+
+# -O: instrumented build, training, rebuild with the profile
+pgoBuildAndInstall() {
+  PGO_PROFILE_DIR="$(pwd)/pgo-profile"
+  rm -rf "$PGO_PROFILE_DIR"
+
+  PGO_STAGE="generate"
+  initMPICHConfigureOpts "$1"
+  pgoStep eval "./configure $MPICH_CONFIGURE_OPTS"
+  makeAndInstall
+  runPGOTraining
+
+  PGO_STAGE="use"
+  initMPICHConfigureOpts "$1"
+  pgoStep eval "./configure $MPICH_CONFIGURE_OPTS"
+  makeAndInstall
+  PGO_STAGE=""
+}
+
 removeOldInstallation() {
   if test ! -d "$1"; then
     return 0
@@ -366,6 +624,9 @@ installation() {
   trylock)
     initMPICHConfigureOpts "trylock"
     ;;
+  hybrid)
+    initMPICHConfigureOpts "hybrid"
+    ;;
   downloadUnpack)
     # no action
     ;;
@@ -376,7 +637,13 @@ installation() {
   showElapsedTime "MPICH options configured"
 
   case $installationType in
-  global | handoff | trylock)
+  global | handoff | trylock | hybrid)
+    if test "$pgoBuild" = true; then
+      pgoBuildAndInstall "$installationType"
+      changeOwnershipToUser "$MPICH_PATH"
+      echo "$LOG_PREFIX MPICH PGO/LTO installation finished! MPICH directory: $MPICH_PATH"
+      return 0
+    fi
     SECONDS=0
     eval "./configure $MPICH_CONFIGURE_OPTS" >> "$LOG_FILE_PATH"
     showElapsedTime "MPICH configured"
@@ -446,6 +713,9 @@ initDefaultOptions() {
   #optimized build without debug info
   optimizedBuild=false
 
+  #optimized build with LTO and profile-guided optimization
+  pgoBuild=false
+
   #get sources from github repo
   github=false
 
@@ -474,7 +744,7 @@ fi
 
 initDefaultOptions
 
-while getopts ":srp:b:i:ol:" opt; do
+while getopts ":srp:b:i:oOtvmal:" opt; do
   case $opt in
   s) #skip user manual input
     echo "$LOG_PREFIX Skip manual input"
@@ -494,14 +764,36 @@ while getopts ":srp:b:i:ol:" opt; do
     ;;
   p) #check per-vci
     perVciType=${OPTARG}
-    if test "$perVciType" != "trylock" && test "$perVciType" != "handoff"; then
-      echo "$LOG_PREFIX Wrong per-vci type, trylock or handoff only!"
+    if test "$perVciType" != "trylock" && test "$perVciType" != "handoff" &&
+      test "$perVciType" != "hybrid"; then
+      echo "$LOG_PREFIX Wrong per-vci type, trylock, handoff or hybrid only!"
       exit 1
     fi
     ;;
   o) #optimized installation build
     optimizedBuild=true
     ;;
+  O) #optimized installation build with LTO and PGO
+    echo "$LOG_PREFIX PGO/LTO build enabled"
+    optimizedBuild=true
+    pgoBuild=true
+    ;;
+  t) #ch4 event tracer, see dev/src/mpid/ch4/src/ch4_trace.h
+    echo "$LOG_PREFIX CH4 event tracer enabled"
+    EXTRA_CFLAGS="$EXTRA_CFLAGS -DMPIDI_CH4_TRACE"
+    ;;
+  v) #per-vci lock contention profiler, see dev/src/mpid/ch4/src/ch4_vci_prof.h
+    echo "$LOG_PREFIX Per-VCI contention profiler enabled"
+    EXTRA_CFLAGS="$EXTRA_CFLAGS -DMPIDI_CH4_VCI_PROFILE"
+    ;;
+  m) #vci mapping, see dev/src/mpid/ch4/src/ch4_vci_map.h
+    echo "$LOG_PREFIX VCI mapping enabled"
+    EXTRA_CFLAGS="$EXTRA_CFLAGS -DMPIDI_CH4_VCI_MAP"
+    ;;
+  a) #per-vci async progress threads, see dev/src/mpid/ch4/src/ch4_vci_progress.h
+    echo "$LOG_PREFIX Per-VCI progress threads enabled"
+    EXTRA_CFLAGS="$EXTRA_CFLAGS -DMPIDI_CH4_VCI_PROGRESS"
+    ;;
   i)
     ADDITIONAL_INSTALLATION_PATH_SUFFIX=${OPTARG}
     echo "$LOG_PREFIX Additional installation path suffix is set to $ADDITIONAL_INSTALLATION_PATH_SUFFIX"
@@ -524,9 +816,32 @@ done
 
 OPTIND=1
 
+case "$EXTRA_CFLAGS" in
+*-DMPIDI_CH4_VCI_PROGRESS*)
+  if test "$perVciType" != "hybrid"; then
+    echo "$LOG_PREFIX -a needs -p hybrid: the hybrid handoffs wake the progress threads"
+    exit 1
+  fi
+  if test "$github" = true; then
+    # per-VCI progress (MPIDI_progress_test_vci) in the github sources
+    EXTRA_CFLAGS="$EXTRA_CFLAGS -DMPIDI_DEV_PROGRESS_VCI"
+  fi
+  ;;
+esac
+
+# -flto=auto and the -fprofile-* options of -O are GCC (10 or later) flags
+if test "$pgoBuild" = true; then
+  pgoCC=${CC:-gcc}
+  if ! "$pgoCC" -v 2>&1 | grep -q "^gcc version" ||
+    test "$("$pgoCC" -dumpversion | cut -d. -f1)" -lt 10; then
+    echo "$LOG_PREFIX -O needs GCC 10 or later as CC, $pgoCC is not"
+    exit 1
+  fi
+fi
+
 installHwloc
 
-while getopts ":gdhp:" opt; do
+while getopts ":gdhp:srb:i:oOtvmal:" opt; do
   case $opt in
   g) #global critical section
     echo "$LOG_PREFIX Use global critical section"
@@ -544,7 +859,9 @@ while getopts ":gdhp:" opt; do
   h) #help message
     echo "	$HELP"
     ;;
-  \?) #end of line
+  s | r | b | i | o | O | t | v | m | a | l) #handled above
+    ;;
+  \?) #unknown option
     exit 1
     ;;
   :) #empty or unknown arg
@@ -4,7 +4,10 @@
 # Script for running of MPI program with debugging in GDB
 ##
 
-export MPIR_CVAR_ASYNC_PROGRESS=1
+# 1 - per-VCI progress threads of an installMPICH.sh -p hybrid -a -r build
+#     (started only if the program asks for MPI_THREAD_MULTIPLE),
+# 0 - the single global async progress thread
+VCI_PROGRESS=0
 
 EXEC_PATH=/home/parallels/mpich/projects/MPI/VerySimple/cmake-build-debug
 EXEC=VerySimple
@@ -12,8 +15,21 @@ CUSTOM_BUILD_MPICH_FOLDER=/home/parallels/mpich/build
 MPI_PER_VNI_TRYLOCK=$CUSTOM_BUILD_MPICH_FOLDER/mpich4-pervni-trylock/bin
 MPI_PER_VNI_HANDOFF=$CUSTOM_BUILD_MPICH_FOLDER/mpich4-pervni-handoff/bin
 
+MPI_PER_VNI_HYBRID_PROGRESS=$CUSTOM_BUILD_MPICH_FOLDER/mpich4-pervni-hybrid-progress/bin
+
 CURRENT_MPI=$MPI_PER_VNI_HANDOFF
 
+if (( VCI_PROGRESS == 1 )); then
+    # pin them with e.g. MPIR_CVAR_CH4_VCI_PROGRESS_CORES=4-7
+    CURRENT_MPI=$MPI_PER_VNI_HYBRID_PROGRESS
+    export MPIR_CVAR_ASYNC_PROGRESS=0
+    unset MPIR_CVAR_CH4_VCI_PROGRESS_THREADS
+else
+    export MPIR_CVAR_ASYNC_PROGRESS=1
+    # in case CURRENT_MPI is a -a build
+    export MPIR_CVAR_CH4_VCI_PROGRESS_THREADS=0
+fi
+
 PROCNUM=2
 
 # Height and width for a half of screen (in symbols)
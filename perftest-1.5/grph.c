@@ -26,6 +26,9 @@ extern int __NUMNODES, __MYPROCID;
  */
 typedef enum { GRF_X, GRF_EPS, GRF_PS, GRF_GIF } OutputForm;
 
+/* Maximum number of extra columns (see DataExtraColumns) */
+#define MAX_EXTRA 16
+
 struct _GraphData {
     FILE *fp, *fpdata;
     char *fname2;
@@ -48,6 +51,10 @@ struct _GraphData {
     int is_log;
     char *title;
     OutputForm output_type;
+    /* Extra columns appended to every data line, after the rate */
+    int nextra;
+    char extra_names[256];
+    double extra[MAX_EXTRA];
     };
 
 /* Forward refs */
@@ -59,6 +66,7 @@ void DrawCIt( GraphData ctx, int first, int last, double s, double r );
 void DrawGopCIt( GraphData ctx, int first, int last, double s, double r, 
 		 int nsizes, int *sizelist );
 void EndPageCIt( GraphData ctx );
+static void EndOrderCIt( GraphData ctx );
 
 void HeaderGnuplot( GraphData ctx, char *protocol_name, 
 		    char *title_string, char *units );
@@ -112,9 +120,10 @@ void HeaderCIt( GraphData ctx, char *protocol_name, char *title_string,
     }
     else {
 	if (ctx->do_rate) 
-	    fputs( "set order d d d x d y\n", ctx->fp );
+	    fputs( "set order d d d x d y", ctx->fp );
 	else
-	    fprintf( ctx->fp, "set order d d d x y d\n" );
+	    fprintf( ctx->fp, "set order d d d x y d" );
+	EndOrderCIt( ctx );
     }
     if (ctx->is_log) 
 	fprintf( ctx->fp, "set scale x log y log\n" );
@@ -151,7 +160,8 @@ void HeaderCIt( GraphData ctx, char *protocol_name, char *title_string,
 		     archname, hostname, date, protocol_name );
 	}
     }
-    fprintf( ctx->fp, "\n#p0\tp1\tdist\tlen\tave time (us)\trate\n");
+    fprintf( ctx->fp, "\n#p0\tp1\tdist\tlen\tave time (us)\trate%s\n",
+	     ctx->extra_names );
     fflush( ctx->fp );
 }
 
@@ -204,10 +214,12 @@ void DataoutGraph( GraphData ctx, int proc1, int proc2, int distance,
 		   int len, double t, double mean_time, double rate,
 		   double tmean, double tmax )
 {
+    int i;
+
     if (!ctx) return;
 
     if(ctx->givedy) 
-	fprintf( ctx->fpdata, "%d\t%d\t%d\t%d\t%f\t%.2f\t%f\t%f\n",
+	fprintf( ctx->fpdata, "%d\t%d\t%d\t%d\t%f\t%.2f\t%f\t%f",
 		 proc1, proc2, distance, len, tmean * 1.0e6, rate, 
 		 mean_time*1.0e6, tmax * 1.0e6 );
     else {
@@ -215,15 +227,47 @@ void DataoutGraph( GraphData ctx, int proc1, int proc2, int distance,
 	fprintf( ctx->fpdata, "%d\t%d\t%d\t%d\t%f\t",
 		 proc1, proc2, distance, len, mean_time*1.0e6 );
 	if (rate > 1.0e6) {
-	    fprintf( ctx->fpdata, "%.3fe+6\n", rate * 1.0e-6 );
+	    fprintf( ctx->fpdata, "%.3fe+6", rate * 1.0e-6 );
 	}
 	else if (rate > 1.0e3) {
-	    fprintf( ctx->fpdata, "%.3fe+3\n", rate * 1.0e-3 );
+	    fprintf( ctx->fpdata, "%.3fe+3", rate * 1.0e-3 );
 	}
 	else {
-	    fprintf( ctx->fpdata, "%.2f\n", rate );
+	    fprintf( ctx->fpdata, "%.2f", rate );
 	}
     }
+    for (i=0; i<ctx->nextra; i++) 
+	fprintf( ctx->fpdata, "\t%g", ctx->extra[i] );
+    fprintf( ctx->fpdata, "\n" );
+}
+
+/* Add n columns, named by the tab-separated names, to the data lines.
+   Must be called before the header is generated; the values for each
+   line are given with DataoutExtra before calling DataoutGraph */
+void DataExtraColumns( GraphData ctx, int n, char *names )
+{
+    if (!ctx) return;
+
+    if (ctx->nextra + n > MAX_EXTRA || 
+	strlen(ctx->extra_names) + strlen(names) + 2 > 
+	sizeof(ctx->extra_names)) {
+	fprintf( stderr, "Too many extra output columns\n" );
+	return;
+    }
+    ctx->nextra += n;
+    strcat( ctx->extra_names, "\t" );
+    strcat( ctx->extra_names, names );
+}
+
+/* Set the values of the extra columns for the next data line */
+void DataoutExtra( GraphData ctx, double *vals )
+{
+    int i;
+
+    if (!ctx) return;
+
+    for (i=0; i<ctx->nextra; i++) 
+	ctx->extra[i] = vals[i];
 }
 
 void DataoutGraphForGop( GraphData ctx, int len, double t, double mean_time, 
@@ -294,15 +338,18 @@ void DrawCIt( GraphData ctx, int first, int last, double s, double r )
 
 /* Convert to one-way performance */
     if (ctx->givedy) {
-	fprintf( ctx->fp, "set order d d d x y d d d\n" );
+	fprintf( ctx->fp, "set order d d d x y d d d" );
+	EndOrderCIt( ctx );
 	if (ctx->do_rate) 
 	    fputs( "set change y 'x * 1.0e-6'\n", ctx->fp );
 	fprintf( ctx->fp, "plot\n" );
-	fprintf( ctx->fp, "set order d d d x d d y d\n" );
+	fprintf( ctx->fp, "set order d d d x d d y d" );
+	EndOrderCIt( ctx );
 	if (ctx->do_rate) 
 	    fputs( "set change y 'x * 1.0e-6'\n", ctx->fp );
 	fprintf( ctx->fp, "join\n" );
-	fprintf( ctx->fp, "set order d d d x d d d y\n" );
+	fprintf( ctx->fp, "set order d d d x d d d y" );
+	EndOrderCIt( ctx );
 	if (ctx->do_rate) 
 	    fputs( "set change y 'x * 1.0e-6'\n", ctx->fp );
 	fprintf( ctx->fp, "join\n" );
@@ -321,6 +368,16 @@ void DrawCIt( GraphData ctx, int first, int last, double s, double r )
     }
 }
 
+/* Skip the extra columns at the end of a "set order" line */
+static void EndOrderCIt( GraphData ctx )
+{
+    int i;
+
+    for (i=0; i<ctx->nextra; i++) 
+	fputs( " d", ctx->fp );
+    fputs( "\n", ctx->fp );
+}
+
 void DrawGopCIt( GraphData ctx, int first, int last, double s, double r, 
 		 int nsizes, int *sizelist )
 {
@@ -408,7 +465,8 @@ void HeaderGnuplot( GraphData ctx, char *protocol_name,
 	fprintf( ctx->fp, "set title \"Comm Perf for %s (%s) on %s type %s\"\n", 
 		 archname, hostname, date, protocol_name );
     }
-    fprintf( ctx->fpdata, "\n#p0\tp1\tdist\tlen\tave time (us)\trate\n");
+    fprintf( ctx->fpdata, "\n#p0\tp1\tdist\tlen\tave time (us)\trate%s\n",
+	     ctx->extra_names );
     fflush( ctx->fp );
 }
 
@@ -572,6 +630,8 @@ GraphData SetupGraph( int *argc, char *argv[] )
     OutputForm output_type = GRF_X;
 
     new = (GraphData)malloc(sizeof(struct _GraphData));    if (!new)return 0;;
+    new->nextra         = 0;
+    new->extra_names[0] = 0;
 
     filename[0] = 0;
     /* Set default.  The gnuplot isn't as nice (separate file for data) */
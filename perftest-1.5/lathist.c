@@ -0,0 +1,162 @@
+/* -*- Mode: C; c-basic-offset:4 ; -*- */
+#include <stdio.h>
+
+#include "mpi.h"
+#include "mpptest.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+/*
+    This file contains the per-iteration latency histograms used by
+    mpptest -histogram.
+
+    The timing loops read a clock after every iteration (LAT_LAP) and add
+    the difference to lat_hist, which RunTest points at the histogram of
+    the message length under test.  The histogram is log-bucketed, as in
+    HdrHistogram: values below 2^LAT_SUB_BITS ticks have a bucket each, and
+    every larger power of two is split into 2^(LAT_SUB_BITS-1) buckets, so
+    that any value is known to within 1.6% at a fixed, small memory cost.
+
+    The clock is MPI_Wtime (in ns ticks) or, with LatSetup(1) on x86, the
+    time stamp counter, whose rate is calibrated against MPI_Wtime.  The
+    TSC is cheaper to read, but it is only a clock if it is invariant
+    (constant rate, synchronized across cores); check for constant_tsc in
+    /proc/cpuinfo.
+ */
+
+LatHist *lat_hist = 0;
+
+static int    lat_use_tsc = 0;
+static double lat_tick    = 1.0e-9;     /* seconds per tick */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_LAT_TSC
+static LatTick LatReadTsc( void )
+{
+    unsigned int lo, hi;
+    __asm__ __volatile__ ( "rdtsc" : "=a" (lo), "=d" (hi) );
+    return ((LatTick)hi << 32) | lo;
+}
+#endif
+
+/* Select the clock; returns 1 if the TSC is used */
+int LatSetup( int use_tsc )
+{
+    lat_use_tsc = 0;
+    lat_tick    = 1.0e-9;
+#ifdef HAVE_LAT_TSC
+    if (use_tsc) {
+	double  t0, t1;
+	LatTick c0, c1;
+
+	/* 20 ms is enough for a rate good to better than 0.1% */
+	t0 = MPI_Wtime();
+	c0 = LatReadTsc();
+	do {
+	    t1 = MPI_Wtime();
+	} while (t1 - t0 < 0.02);
+	c1 = LatReadTsc();
+	if (c1 > c0) {
+	    lat_tick    = (t1 - t0) / (double)(c1 - c0);
+	    lat_use_tsc = 1;
+	}
+    }
+#endif
+    if (use_tsc && !lat_use_tsc)
+	fprintf( stderr, "No usable time stamp counter, using MPI_Wtime\n" );
+    return lat_use_tsc;
+}
+
+LatTick LatNow( void )
+{
+#ifdef HAVE_LAT_TSC
+    if (lat_use_tsc) return LatReadTsc();
+#endif
+    return (LatTick)(MPI_Wtime() * 1.0e9);
+}
+
+static int LatBucket( LatTick v )
+{
+    int msb, shift;
+
+    if (v < ((LatTick)1 << LAT_SUB_BITS)) return (int)v;
+    if (v >= ((LatTick)1 << LAT_MAX_BITS)) return LAT_NBUCKETS - 1;
+#ifdef __GNUC__
+    msb = 63 - __builtin_clzll( v );
+#else
+    for (msb=LAT_SUB_BITS; (v >> (msb+1)) != 0; msb++) ;
+#endif
+    shift = msb - LAT_SUB_BITS + 1;
+    return (shift << (LAT_SUB_BITS - 1)) + (int)(v >> shift);
+}
+
+/* Middle of bucket b, in ticks */
+static double LatBucketValue( int b )
+{
+    int shift, sub;
+
+    if (b < (1 << LAT_SUB_BITS)) return (double)b;
+    shift = (b >> (LAT_SUB_BITS - 1)) - 1;
+    sub   = b - (shift << (LAT_SUB_BITS - 1));
+    return ((double)sub + 0.5) * (double)((LatTick)1 << shift);
+}
+
+/* Add the time since start to h; returns the current time, which is the
+   start of the next iteration */
+LatTick LatRecord( LatHist *h, LatTick start )
+{
+    LatTick now = LatNow(), v;
+
+    v = (now > start) ? now - start : 0;
+    h->bucket[LatBucket( v )]++;
+    h->count += 1;
+    if (v > h->max) h->max = v;
+    return now;
+}
+
+/* Add a time given in seconds */
+void LatRecordTime( LatHist *h, double t )
+{
+    LatTick v;
+
+    v = (t > 0) ? (LatTick)(t / lat_tick) : 0;
+    h->bucket[LatBucket( v )]++;
+    h->count += 1;
+    if (v > h->max) h->max = v;
+}
+
+LatHist *LatAlloc( void )
+{
+    LatHist *h;
+
+    h = (LatHist *)calloc( 1, sizeof(LatHist) );
+    if (!h) MPI_Abort( MPI_COMM_WORLD, 1 );
+    return h;
+}
+
+/* Time (in seconds) below which the fraction q of the iterations fall */
+double LatPercentile( LatHist *h, double q )
+{
+    double need, seen = 0, v;
+    int    b;
+
+    if (!h || h->count < 1) return 0.0;
+    need = q * h->count;
+    for (b=0; b<LAT_NBUCKETS; b++) {
+	seen += h->bucket[b];
+	if (seen >= need && h->bucket[b]) break;
+    }
+    if (b == LAT_NBUCKETS) b--;
+    v = LatBucketValue( b );
+    /* The bucket middle may be above the largest value seen */
+    if (v > (double)h->max) v = (double)h->max;
+    return v * lat_tick;
+}
+
+double LatMax( LatHist *h )
+{
+    if (!h) return 0.0;
+    return (double)h->max * lat_tick;
+}
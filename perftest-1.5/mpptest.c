@@ -82,6 +82,27 @@ static int    minreps       = 30;
 static int    n_stable;
 static double repsThresh    = 0.05;
 
+/* Instead of looking for a stable minimum, -cistop d keeps the mean, 
+   variance and median of the per-loop times of each message length, and 
+   stops testing a length once the 95% confidence interval of its mean is 
+   within d (relative) of the mean.  At least ci_minreps and at most
+   ci_maxreps samples are taken for each length.  With -auto, the lengths
+   are picked first and then sampled the same way.
+ */
+static double cistop        = 0.0;
+static int    ci_minreps    = 5;
+static int    ci_maxreps    = 100;
+
+/* With -histogram, the time of every iteration is recorded in a latency
+   histogram per message length, and the percentiles are output */
+static int    dohist        = 0;
+
+/* Budget for -auto: at most auto_depth refinement passes, and at most
+   auto_max message lengths in all.  Refinement stops (without error) when
+   either is exhausted */
+static int    auto_depth    = 0;
+static int    auto_max      = 1024;
+
 /* n_smooth is the number of passes over the data that will be taken to
    smooth out any anomolies, defined as times that deviate significantly from
    a linear progression
@@ -126,6 +147,16 @@ static double start_time = 0.0;
    list elements in an array, and for many processing tasks (output, smoothing)
    only the list version is used. */
 
+/* Streaming median (the P^2 algorithm of Jain and Chlamtac): five markers
+   at the minimum, the quartiles, the median and the maximum, with their
+   actual and desired positions */
+typedef struct {
+    int    count;
+    double q[5],            /* marker heights */
+	   n[5],            /* marker positions */
+	   np[5];           /* desired marker positions */
+    } P2Median;
+
 /* These are used to contain results for a single test */
 typedef struct _TwinResults {
     double t,               /* min of the observations (per loop) */
@@ -144,6 +175,13 @@ typedef struct _TwinResults {
 			       causing n_avg to be doubled */
     int    nForSmooth;      /* Number of times test was rerun to smooth
 			       results */
+    /* Sample statistics of the per-loop times, used by -cistop */
+    double mean, m2;        /* running mean and sum of squared differences
+			       from the mean (Welford) */
+    P2Median median;
+    int    ci_done;         /* true once the confidence interval is narrow
+			       enough */
+    LatHist *hist;          /* per-iteration times, used by -histogram */
     struct _TwinResults *next, *prev;
     } TwinResults;
 
@@ -162,6 +200,10 @@ void OutputDiagnostics( TwinResults *twin, FILE *fp );
 double LinearTimeEst( TwinResults *, double );
 double LinearTimeEstBase( TwinResults *, TwinResults *, TwinResults*, double );
 TwinResults *InsertElm( TwinResults *, TwinResults * );
+TwinResults *NewResultsElm( void );
+void P2MedianAdd( P2Median *, double );
+double P2MedianValue( P2Median * );
+double SampleCIHalf( TwinResults * );
 
 /* Initialize the results array of a given list of data */
 
@@ -298,6 +340,21 @@ int main( int argc, char *argv[] )
     n_stable = minreps;
     SYArgGetInt( &argc, argv, 1, "-n_stable", &n_stable );
 
+    if (SYArgGetDouble( &argc, argv, 1, "-cistop", &cistop )) {
+	SYArgGetInt( &argc, argv, 1, "-ciminreps", &ci_minreps );
+	SYArgGetInt( &argc, argv, 1, "-cimaxreps", &ci_maxreps );
+	if (ci_minreps < 2) ci_minreps = 2;
+	if (ci_maxreps < ci_minreps) ci_maxreps = ci_minreps;
+	if (cistop > 0) 
+	    DataExtraColumns( outctx, 3, "median (us)\tci95 (us)\tsamples" );
+    }
+    if (SYArgHasName( &argc, argv, 1, "-histogram" )) {
+	dohist = 1;
+	LatSetup( SYArgHasName( &argc, argv, 1, "-histtsc" ) );
+	DataExtraColumns( outctx, 5, 
+	  "p50 (us)\tp90 (us)\tp99 (us)\tp99.9 (us)\tmax (us)" );
+    }
+
     SYArgGetDouble( &argc, argv, 1, "-max_run_time", &max_run_time );
     if (SYArgHasName( &argc, argv, 1, "-quick" ) || 
 	SYArgHasName( &argc, argv, 1, "-fast"  )) {
@@ -314,6 +371,10 @@ int main( int argc, char *argv[] )
 	SYArgGetInt( &argc, argv, 1, "-autodx", &autodx );
 	autorel = 0.02;
 	SYArgGetDouble( &argc, argv, 1, "-autorel", &autorel );
+	/* the passes the sampling loop always made */
+	auto_depth = minreps / 5 - 1;
+	SYArgGetInt( &argc, argv, 1, "-autodepth", &auto_depth );
+	SYArgGetInt( &argc, argv, 1, "-automax", &auto_max );
     }
 
 /* Pick the general test based on the presence of an -gop, -overlap, -bisect
@@ -430,8 +491,15 @@ int main( int argc, char *argv[] )
 	ChangeDist = PairChange;
 	if (SYArgHasName( &argc, argv, 1, "-debug" ))
 	    PrintPairInfo( MsgCtx );
-	TimeScale = 0.5;
-	RateScale = 2.0;
+	if (PairWindow()) {
+	    /* Time per message of a one-way stream */
+	    TimeScale = 1.0;
+	    RateScale = 1.0;
+	}
+	else {
+	    TimeScale = 0.5;
+	    RateScale = 2.0;
+	}
     }
     first = svals[0];
     last  = svals[1];
@@ -530,14 +598,16 @@ void time_function( int n_avg, int first, int last, int incr,
     /* Run test, using either the simple direct test or the automatic length
      test */
     if (autosize) {
-	int k;
+	int k, depth = 0;
 
-	twin = AllocResultsArray( 1024 );
 	/* We want to have enough values for the initial tests to avoid 
 	   missing interesting features.  We really should have an option
 	   for this, but 32 fits the default tests (0 - 1k by 32 has 32 tests)
 	*/
-	SetResultsForStrided( first, last, (last-first)/32, twin );
+	incr = (last-first)/32;
+	if (incr < 1) incr = 1;
+	twin = AllocResultsArray( 1 + (last-first)/incr );
+	SetResultsForStrided( first, last, incr, twin );
 
 	/* Run tests */
 	SetRepsForList( twin, n_avg );
@@ -546,8 +616,21 @@ void time_function( int n_avg, int first, int last, int incr,
 	    for (kk=0; kk<5; kk++)
 		(void)RunTestList( twin, CommTest, msgctx );
 	    /* Don't refine on the last iteration */
-	    if (k != minreps-1) 
-	      RefineTestList( twin, CommTest, msgctx, autodx, autorel );
+	    if (k != minreps/5-1 && depth < auto_depth) {
+		RefineTestList( twin, CommTest, msgctx, autodx, autorel );
+		depth++;
+	    }
+	}
+	/* Use the rest of the depth budget where the lengths are still
+	   far from a linear model (the new lengths are caught up with the
+	   samples of the others by RefineTestList) */
+	while (depth < auto_depth && 
+	       RefineTestList( twin, CommTest, msgctx, autodx, autorel ))
+	    depth++;
+	/* With -cistop, sample the chosen lengths until their confidence
+	   intervals are narrow enough */
+	for (k=0; cistop > 0 && k<ci_maxreps; k++) {
+	    if (!RunTestList( twin, CommTest, msgctx )) break;
 	}
 	for (k=1; k<n_smooth; k++) {
 	    if (!SmoothList( twin, CommTest, msgctx )) break;
@@ -571,7 +654,13 @@ void time_function( int n_avg, int first, int last, int incr,
 	/* Run tests */
 	SetRepsForList( twin, n_avg );
 	n_without_change = 0;
-	for (k=1; k<minreps; k++) {
+	/* With -cistop, run until every length has a narrow enough 
+	   confidence interval; RunTestList returns the number of lengths 
+	   that still need samples */
+	for (k=0; cistop > 0 && k<ci_maxreps; k++) {
+	    if (!RunTestList( twin, CommTest, msgctx )) break;
+	}
+	for (k=1; cistop <= 0 && k<minreps; k++) {
 	    if (RunTestList( twin, CommTest, msgctx )) {
 	        n_without_change = 0;
 	    }
@@ -642,6 +731,11 @@ combinations of\n\
   -roundtrip   Roundtrip messages         (default)\n\
   -head        Head-to-head messages\n\
   -halo        Halo Exchange (multiple head-to-head; limited options)\n\
+  -window n    One-way stream of -async messages, n in flight, each window\n\
+               acknowledged; reports the time per message\n\
+  -threads n   With -window and -threadmultiple, n threads per process each\n\
+               stream on their own communicator; reports the time per message\n\
+               of all threads together\n\
     \n" );
 PrintHaloHelp();
 
@@ -676,7 +770,11 @@ PrintHaloHelp();
   -auto        Compute message sizes automatically (to create a smooth\n\
                graph.  Use -size values for lower and upper range\n\
   -autodx n    Minimum number of bytes between samples when using -auto\n\
-  -autorel d   Relative error tolerance when using -auto (0.02 by default)\n");
+  -autorel d   Relative error tolerance when using -auto (0.02 by default)\n\
+  -autodepth n Maximum number of refinement passes when using -auto (each\n\
+               pass at most halves the intervals; by default sample_reps/5-1)\n\
+  -automax n   Maximum number of message lengths when using -auto (default\n\
+               %d); refinement stops once it is reached\n", auto_max );
 
   fprintf( stderr, "\n\
   Detailed control of tests:\n\
@@ -697,7 +795,20 @@ PrintHaloHelp();
                the value of -sample_reps is used (i.e.,no early termination)\n\
   -max_run_time n  Maximum number of seconds for all tests.  The default\n\
                is %d\n\
-\n", DEFAULT_AVG, (int)max_run_time );
+  -cistop d    Instead of the minimum, report the mean time with its 95%%\n\
+               confidence interval and the median.  Each length is tested\n\
+               until the interval is within d (relative) of the mean, e.g.\n\
+               0.02 for +/- 2%%.  With -auto, the lengths are picked first\n\
+               and then sampled until their intervals are narrow enough\n\
+  -ciminreps n Minimum number of samples per length with -cistop (default %d)\n\
+  -cimaxreps n Maximum number of samples per length with -cistop (default %d)\n\
+  -histogram   Time every iteration and output the 50, 90, 99 and 99.9\n\
+               percentiles and the maximum of each length.  Tests without\n\
+               per-iteration timing (halo, overlap, bisect, memcpy) record\n\
+               the average of each test instead\n\
+  -histtsc     With -histogram, use the x86 time stamp counter (which must\n\
+               be invariant) instead of MPI_Wtime\n\
+\n", DEFAULT_AVG, (int)max_run_time, ci_minreps, ci_maxreps );
 
 fprintf( stderr, "\n\
   Collective operations may be tested with -gop [ options ]:\n" );
@@ -720,33 +831,80 @@ fflush( stderr );
  * New code that uses a list to manage all timing experiments
 
  ****************************************************************************/
-/* Setup the results array */
-static TwinResults *twin_avail = 0;
+/* Setup the results array.  Entries added by refinement come from chunks
+   of RESULTS_CHUNK entries, allocated as needed; entries never move, so
+   the list pointers stay valid as the storage grows */
+#define RESULTS_CHUNK 256
+typedef struct _ResultsChunk {
+    struct _ResultsChunk *next;
+    TwinResults          elm[RESULTS_CHUNK];
+    } ResultsChunk;
+
+static ResultsChunk *twin_chunks = 0;
+static TwinResults  *twin_avail  = 0;    /* free entries, linked by next */
+static int          twin_nelm    = 0;    /* entries in the list */
 
 TwinResults *AllocResultsArray( int nsizes )
 {
     TwinResults *new;
     int         i;
 
-    new = (TwinResults *)calloc( nsizes+1, sizeof(TwinResults) );
+    new = (TwinResults *)calloc( nsizes, sizeof(TwinResults) );
     if (!new) MPI_Abort( MPI_COMM_WORLD, 1 );
 
-    for (i=1; i<nsizes-1; i++) {
-	new[i].next = &new[i+1];
-	new[i].prev = &new[i-1];
+    for (i=0; i<nsizes; i++) {
+	new[i].next = (i < nsizes-1) ? &new[i+1] : 0;
+	new[i].prev = (i > 0) ? &new[i-1] : 0;
     }
-    new[0].next	       = &new[1];
-    new[0].prev	       = 0;
-    new[nsizes-1].next = 0;
-    new[nsizes-1].prev = &new[nsizes-2];
-    /* Note that the last member (new[nsizes]) has null prev and next */
+    twin_chunks = 0;
+    twin_avail  = 0;
+    twin_nelm   = nsizes;
 
     return new;
 }
 
+/* Get a cleared entry for the list, growing the storage if necessary */
+TwinResults *NewResultsElm( void )
+{
+    TwinResults *tnew;
+    int         i;
+
+    if (!twin_avail) {
+	ResultsChunk *chunk;
+	chunk = (ResultsChunk *)calloc( 1, sizeof(ResultsChunk) );
+	if (!chunk) {
+	    fprintf( stderr, "Could not allocate memory for results\n" );
+	    MPI_Abort( MPI_COMM_WORLD, 1 );
+	}
+	chunk->next = twin_chunks;
+	twin_chunks = chunk;
+	for (i=0; i<RESULTS_CHUNK-1; i++) 
+	    chunk->elm[i].next = &chunk->elm[i+1];
+	twin_avail = &chunk->elm[0];
+    }
+    tnew       = twin_avail;
+    twin_avail = twin_avail->next;
+    memset( tnew, 0, sizeof(TwinResults) );
+    twin_nelm++;
+
+    return tnew;
+}
+
 void FreeResults( TwinResults *twin_p )
 {
+    TwinResults  *p;
+    ResultsChunk *chunk;
+
+    for (p=twin_p; p; p=p->next) 
+	if (p->hist) free( p->hist );
     free( twin_p );
+    while (twin_chunks) {
+	chunk       = twin_chunks;
+	twin_chunks = chunk->next;
+	free( chunk );
+    }
+    twin_avail = 0;
+    twin_nelm  = 0;
 }
 
 /* Initialize the results array for a strided set of data */
@@ -760,10 +918,6 @@ void SetResultsForStrided( int first, int last, int incr, TwinResults *twin )
     }
     /* Fixup list */
     twin[i-1].next = 0;
-    twin[i].prev   = 0;
-
-    /* Setup to the avail list */
-    twin_avail = &twin[i];
 }
 
 /* Initialize the results array of a given list of data */
@@ -776,10 +930,6 @@ void SetResultsForList( int sizelist[], int nsizes, TwinResults *twin )
     }
     /* Fixup list */
     twin[i-1].next = 0;
-    twin[i].prev   = 0;
-
-    /* Setup to the avail list */
-    twin_avail = &twin[i];
 }
 
 /* Run a test for a single entry in the list. Return 1 if the test
@@ -794,11 +944,22 @@ void SetResultsForList( int sizelist[], int nsizes, TwinResults *twin )
 int RunTest( TwinResults *twin_p, double (*CommTest)(int,int,void *),
 	     void *msgctx, double wtick )
 {
-    double t;
+    double t, n_iter = 0;
 
     /* Run the test */
+    if (dohist) {
+	if (!twin_p->hist) twin_p->hist = LatAlloc();
+	lat_hist = twin_p->hist;
+	n_iter   = lat_hist->count;
+    }
     t = (*CommTest)( twin_p->n_avg, twin_p->len, msgctx );
     /* t is the time over all (n_avg tests) */
+    if (dohist) {
+	/* Tests without a per-iteration clock add the average */
+	if (lat_hist->count == n_iter && __MYPROCID == 0) 
+	    LatRecordTime( lat_hist, t / twin_p->n_avg );
+	lat_hist = 0;
+    }
 
     /* Make sure that everyone has the same time value so that
        they'll make the same decisions.  
@@ -825,6 +986,16 @@ int RunTest( TwinResults *twin_p, double (*CommTest)(int,int,void *),
 	else
 	    twin_p->new_min_found = 0;
 	if (t > twin_p->max_time) twin_p->max_time = t;
+	if (cistop > 0) {
+	    double delta = t - twin_p->mean;
+	    twin_p->mean += delta / twin_p->n_loop;
+	    twin_p->m2   += delta * (t - twin_p->mean);
+	    P2MedianAdd( &twin_p->median, t );
+	    if (twin_p->n_loop >= ci_maxreps ||
+		(twin_p->n_loop >= ci_minreps && 
+		 SampleCIHalf( twin_p ) <= cistop * twin_p->mean))
+		twin_p->ci_done = 1;
+	}
 	return 1;
     }
     else {
@@ -835,7 +1006,8 @@ int RunTest( TwinResults *twin_p, double (*CommTest)(int,int,void *),
 }
 
 /* For each message length in the list, run the experiement CommTest.
-   Return the number of records that were updated */
+   Return the number of records that were updated (with -cistop, the 
+   number of records that still need samples) */
 int RunTestList( TwinResults *twin_p, double (*CommTest)(int,int,void *),
 		  void *msgctx )
 {
@@ -845,6 +1017,10 @@ int RunTestList( TwinResults *twin_p, double (*CommTest)(int,int,void *),
 			 new minimum */
 
     while (twin_p) {
+	if (twin_p->ci_done) {
+	    twin_p = twin_p->next;
+	    continue;
+	}
         n_trials = 0;
         while (n_trials++ < 10 && 
 	       !RunTest( twin_p, CommTest, msgctx, gwtick )) {
@@ -853,7 +1029,8 @@ int RunTestList( TwinResults *twin_p, double (*CommTest)(int,int,void *),
 	       Special needs: must ensure that all processes are informed */
 	    twin_p->n_avg *= 2;
         }
-	if (twin_p->new_min_found) n_updated++;
+	if (cistop > 0 ? !twin_p->ci_done : twin_p->new_min_found) 
+	    n_updated++;
 	twin_p = twin_p->next;
     }
 #ifdef DEBUG_AUTO
@@ -862,6 +1039,92 @@ int RunTestList( TwinResults *twin_p, double (*CommTest)(int,int,void *),
     return n_updated;
 }
 
+/* Half width of the 95% confidence interval of the mean time, from the
+   Student t distribution with n_loop-1 degrees of freedom */
+double SampleCIHalf( TwinResults *twin_p )
+{
+    static double t95[30] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 
+			      2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 
+			      2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 
+			      2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 
+			      2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+    int    n = twin_p->n_loop;
+    double tcrit;
+
+    if (n < 2) return HUGE_VAL;
+    /* Beyond 30, 1.96 + 2.4/df is within 0.1% of the exact value */
+    tcrit = (n - 1 <= 30) ? t95[n-2] : 1.96 + 2.4 / (n - 1);
+    return tcrit * sqrt( twin_p->m2 / (n - 1) / n );
+}
+
+/* Add an observation to the streaming median */
+void P2MedianAdd( P2Median *m, double x )
+{
+    static double dn[5] = { 0.0, 0.25, 0.5, 0.75, 1.0 };
+    double d, s, qp;
+    int    i, k;
+
+    if (m->count < 5) {
+	/* Keep the first observations sorted; they are the initial markers */
+	for (i=m->count; i>0 && m->q[i-1] > x; i--) 
+	    m->q[i] = m->q[i-1];
+	m->q[i] = x;
+	if (++m->count == 5) {
+	    for (i=0; i<5; i++) {
+		m->n[i]  = i;
+		m->np[i] = 4 * dn[i];
+	    }
+	}
+	return;
+    }
+
+    /* Find the cell k with q[k] <= x < q[k+1], extending the extremes */
+    if (x < m->q[0]) {
+	m->q[0] = x;
+	k       = 0;
+    }
+    else if (x >= m->q[4]) {
+	m->q[4] = x;
+	k       = 3;
+    }
+    else {
+	for (k=0; k<3 && x >= m->q[k+1]; k++) ;
+    }
+    for (i=k+1; i<5; i++) m->n[i]  += 1;
+    for (i=0; i<5; i++)   m->np[i] += dn[i];
+    m->count++;
+
+    /* Move the middle markers toward their desired positions, with the 
+       piecewise-parabolic prediction if it keeps the markers ordered */
+    for (i=1; i<4; i++) {
+	d = m->np[i] - m->n[i];
+	if ((d >= 1 && m->n[i+1] - m->n[i] > 1) || 
+	    (d <= -1 && m->n[i-1] - m->n[i] < -1)) {
+	    s  = (d >= 0) ? 1 : -1;
+	    qp = m->q[i] + s / (m->n[i+1] - m->n[i-1]) * 
+		((m->n[i] - m->n[i-1] + s) * (m->q[i+1] - m->q[i]) / 
+		 (m->n[i+1] - m->n[i]) + 
+		 (m->n[i+1] - m->n[i] - s) * (m->q[i] - m->q[i-1]) / 
+		 (m->n[i] - m->n[i-1]));
+	    if (m->q[i-1] < qp && qp < m->q[i+1]) 
+		m->q[i] = qp;
+	    else 
+		m->q[i] += s * (m->q[i+(int)s] - m->q[i]) / 
+		    (m->n[i+(int)s] - m->n[i]);
+	    m->n[i] += s;
+	}
+    }
+}
+
+double P2MedianValue( P2Median *m )
+{
+    if (m->count >= 5) return m->q[2];
+    if (m->count == 0) return 0.0;
+    /* The first observations are kept sorted */
+    if (m->count % 2) return m->q[m->count/2];
+    return 0.5 * (m->q[m->count/2-1] + m->q[m->count/2]);
+}
+
 /* This estimates the time at twin_p using a linear interpolation from the
    surrounding entries */
 double LinearTimeEst( TwinResults *twin_p, double min_dx )
@@ -903,24 +1166,14 @@ TwinResults *InsertElm( TwinResults *prev, TwinResults *next )
 {
     TwinResults *tnew;
 
-    tnew = twin_avail;
-    twin_avail = twin_avail->next;
-    if (!twin_avail) {
-	/* Now we have a problem.  I'm going to generate an error message and
-	   exit */
-	fprintf( stderr, 
-"Exhausted memory for results while refining test interval\n\
-Rerun with a smaller interval or without the -auto option\n" );
-	fflush( stderr );
-	MPI_Abort( MPI_COMM_WORLD, 1 );
-    }
-    twin_avail->prev = 0;
+    tnew = NewResultsElm();
     
     tnew->next  = next;
     tnew->prev  = prev;
     prev->next  = tnew;
     next->prev  = tnew;
-    tnew->len   = (prev->len + next->len) / 2;
+    /* Written to avoid overflow for lengths near INT_MAX */
+    tnew->len   = prev->len + (next->len - prev->len) / 2;
     tnew->n_avg = next->n_avg;
     tnew->t     = HUGE_VAL;
 
@@ -943,8 +1196,8 @@ int RefineTestList( TwinResults *twin, double (*CommTest)(int,int,void*),
     int n_loop, k;
     TwinResults *twin_p = twin, *tprev, *tnext;
 
-    /* There is a dummy empty entry at the end of the list */
-    if (!twin_avail->next) return 0;
+    /* Stop when the budget for message lengths is used up */
+    if (twin_nelm >= auto_max) return 0;
     
     if (min_dx < 1) min_dx = 1;
 
@@ -953,7 +1206,7 @@ int RefineTestList( TwinResults *twin, double (*CommTest)(int,int,void*),
        computed, not the newly inserted values */
     tprev = 0;
     n_loop = 0;
-    while (twin_p && twin_avail) {
+    while (twin_p && twin_nelm < auto_max) {
 	if (twin_p->n_loop > n_loop) n_loop = twin_p->n_loop;
         tnext = twin_p->next;
 	/* Compute error estimate, adjusting for the possibly unequal
@@ -969,12 +1222,12 @@ int RefineTestList( TwinResults *twin, double (*CommTest)(int,int,void*),
 		    twin_p->len, t_center, twin_p->t );
 #endif
 	    /* update the list by refining both segments */
-	    if (twin_p->prev && twin_avail &&
+	    if (twin_p->prev && twin_nelm < auto_max &&
 		min_dx < twin_p->len - twin_p->prev->len) {
 		(void)InsertElm( twin_p->prev, twin_p );
 		n_refined ++; 
 	    }
-	    if (twin_p->next && twin_avail && 
+	    if (twin_p->next && twin_nelm < auto_max && 
 		min_dx < twin_p->next->len - twin_p->len) {
 		(void)InsertElm( twin_p, twin_p->next );
 		n_refined ++;
@@ -1045,7 +1298,8 @@ void OutputTestList( TwinResults *twin, void *outctx, int proc1, int proc2,
 		     int distance )
 {
     TwinResults *twin_p = twin;
-    double rate;
+    double rate, t, extra[8];
+    int    nextra;
 
     while (twin_p) {
 	if (twin_p->n_loop < 1 || twin_p->ntests < 1) {
@@ -1054,15 +1308,38 @@ void OutputTestList( TwinResults *twin, void *outctx, int proc1, int proc2,
 	    continue;
 	}
 
-	/* Compute final quantities */
-	if (twin_p->t > 0) 
-	    rate = ((double)twin_p->len) / twin_p->t;
+	/* Compute final quantities.  With -cistop the mean is reported,
+	   since that is what the confidence interval is for */
+	t      = twin_p->t;
+	nextra = 0;
+	if (cistop > 0) {
+	    t        = twin_p->mean;
+	    extra[nextra++] = P2MedianValue( &twin_p->median ) * TimeScale * 
+		1.0e6;
+	    extra[nextra++] = SampleCIHalf( twin_p ) * TimeScale * 1.0e6;
+	    extra[nextra++] = twin_p->n_loop;
+	}
+	if (dohist) {
+	    extra[nextra++] = LatPercentile( twin_p->hist, 0.50 ) * 
+		TimeScale * 1.0e6;
+	    extra[nextra++] = LatPercentile( twin_p->hist, 0.90 ) * 
+		TimeScale * 1.0e6;
+	    extra[nextra++] = LatPercentile( twin_p->hist, 0.99 ) * 
+		TimeScale * 1.0e6;
+	    extra[nextra++] = LatPercentile( twin_p->hist, 0.999 ) * 
+		TimeScale * 1.0e6;
+	    extra[nextra++] = LatMax( twin_p->hist ) * TimeScale * 1.0e6;
+	}
+	if (nextra) 
+	    DataoutExtra( outctx, extra );
+	if (t > 0) 
+	    rate = ((double)twin_p->len) / t;
 	else
 	    rate = 0.0;
 
 	DataoutGraph( outctx, proc1, proc2, distance, 
-		      (int)twin_p->len, twin_p->t * TimeScale,
-		      twin_p->t * TimeScale, 
+		      (int)twin_p->len, t * TimeScale,
+		      t * TimeScale, 
 		      rate * RateScale, 
 		      twin_p->sum_time / twin_p->ntests * TimeScale, 
 		      twin_p->max_time * TimeScale );
@@ -24,6 +24,7 @@ PairData BisectInit( int );
 void PrintPairInfo( PairData );
 void PairChange( int, PairData );
 void BisectChange( int, PairData );
+int PairWindow( void );
 int set_vector_stride( int );
 
 void *GOPInit( int *, char ** );
@@ -81,6 +82,8 @@ void DataoutGraph( GraphData ctx, int proc1, int proc2, int distance,
 		   int len, double t, double mean_time, double rate,
 		   double tmean, double tmax );
 void DataScale( GraphData, int );
+void DataExtraColumns( GraphData, int, char * );
+void DataoutExtra( GraphData, double * );
 void DrawGraphGop( GraphData ctx, int first, int last, double s, double r, 
 		   int nsizes, int *sizelist );
 void HeaderForGopGraph( GraphData ctx, char *protocol_name, 
@@ -109,6 +112,29 @@ void time_function( int, int, int, int, int, int,
 		    int, int, double, void *);
 void ClearTimes(void);
 
+/* Per-iteration latency histograms (lathist.c).  While lat_hist is set,
+   the timing loops add the time of every iteration to it */
+typedef unsigned long long LatTick;
+#define LAT_SUB_BITS 7              /* 2^(LAT_SUB_BITS-1) buckets per power
+				       of two, i.e., within 1.6% */
+#define LAT_MAX_BITS 40             /* larger times go in the last bucket */
+#define LAT_NBUCKETS ((LAT_MAX_BITS - LAT_SUB_BITS + 2) << (LAT_SUB_BITS - 1))
+typedef struct {
+    double       count;
+    LatTick      max;
+    unsigned int bucket[LAT_NBUCKETS];
+    } LatHist;
+extern LatHist *lat_hist;
+#define LAT_START(t) do { if (lat_hist) (t) = LatNow(); } while (0)
+#define LAT_LAP(t)   do { if (lat_hist) (t) = LatRecord( lat_hist, (t) ); } while (0)
+int LatSetup( int );
+LatTick LatNow( void );
+LatTick LatRecord( LatHist *, LatTick );
+void LatRecordTime( LatHist *, double );
+LatHist *LatAlloc( void );
+double LatPercentile( LatHist *, double );
+double LatMax( LatHist * );
+
 /* Rate */
 void PIComputeRate( double sumlen, double sumtime, double sumlentime, 
 		    double sumlen2, int ntest, double *s, double *r );
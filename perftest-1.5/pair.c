@@ -14,6 +14,10 @@
 
 #include <string.h>
 
+#ifdef HAVE_MPI_INIT_THREAD
+#include <pthread.h>
+#endif
+
 /*****************************************************************************
 
   Each collection of test routines contains:
@@ -202,13 +206,17 @@ void PrintPairInfo( PairData ctx )
     MPE_Seq_end(MPI_COMM_WORLD,1 );
 }
 
-typedef enum { HEADtoHEAD, ROUNDTRIP } CommType;
+typedef enum { HEADtoHEAD, ROUNDTRIP, STREAM } CommType;
 typedef enum { Blocking, NonBlocking, ReadyReceiver, MPISynchronous, 
 	       Persistant, Vector, VectorType, Put, Get } 
                Protocol;
 typedef enum { SpecifiedSource, AnySource } SourceType;
 static SourceType source_type = AnySource;
 static int MsgPending = 0;
+static int Window = 0;          /* messages in flight with -window */
+#define MAX_STREAM_THREADS 64
+static int Threads = 1;         /* concurrent streams with -threads */
+static MPI_Comm ThreadComm[MAX_STREAM_THREADS];
 
 double exchange_forcetype( int, int, PairData );
 double exchange_async( int, int, PairData );
@@ -227,6 +235,8 @@ double round_trip_nc_sync( int, int, PairData );
 double round_trip_nc_force( int, int, PairData );
 double round_trip_nc_async( int, int, PairData );
 
+double stream_async( int, int, PairData );
+
 #if ! defined(HAVE_MPI_PUT)
 #define round_trip_put 0
 #define round_trip_nc_put 0
@@ -317,6 +327,27 @@ double ((*GetPairFunction( int *argc, char *argv[], char *protocol_name )) ( int
     use_cache = SYArgGetInt( argc, argv, 1, "-cachesize", &CacheSize );
     if (SYArgHasName( argc, argv, 1, "-head"  ))     comm_type = HEADtoHEAD;
     if (SYArgHasName( argc, argv, 1, "-roundtrip" )) comm_type = ROUNDTRIP;
+    if (SYArgGetInt( argc, argv, 1, "-window", &Window )) {
+	if (Window < 1) Window = 1;
+	comm_type = STREAM;
+	strcat( protocol_name, "-window" );
+    }
+    if (SYArgGetInt( argc, argv, 1, "-threads", &Threads )) {
+	int provided = MPI_THREAD_SINGLE, t;
+	if (Threads < 1) Threads = 1;
+	if (Threads > MAX_STREAM_THREADS) Threads = MAX_STREAM_THREADS;
+#ifdef HAVE_MPI_INIT_THREAD
+	MPI_Query_thread( &provided );
+#endif
+	if (comm_type != STREAM || provided != MPI_THREAD_MULTIPLE) {
+	    fprintf( stderr, "-threads needs -window and -threadmultiple\n" );
+	    MPI_Abort( MPI_COMM_WORLD, 1 );
+	}
+	/* every thread streams on its own communicator */
+	for (t = 0; t < Threads; t++)
+	    MPI_Comm_dup( MPI_COMM_WORLD, &ThreadComm[t] );
+	sprintf( protocol_name + strlen(protocol_name), "(%d threads)", Threads );
+    }
 
     if (comm_type == ROUNDTRIP) {
 	if (use_cache) {
@@ -348,6 +379,9 @@ double ((*GetPairFunction( int *argc, char *argv[], char *protocol_name )) ( int
 	    }
 	}
     }
+    else if (comm_type == STREAM) {
+	f = protocol == NonBlocking && !use_cache ? stream_async : 0;
+    }
     else {
 	switch( protocol ) {
 	case ReadyReceiver: f = exchange_forcetype; break;
@@ -381,6 +415,7 @@ double exchange_sync( int reps, int len, PairData ctx)
   int  recv_from;
   char *sbuffer, *rbuffer;
   double t0, t1;
+  LatTick lt = 0;
   MPI_Status status;
 
   sbuffer = (char *)malloc(len);
@@ -398,10 +433,12 @@ double exchange_sync( int reps, int len, PairData ctx)
     if (source_type == SpecifiedSource) recv_from = to;
     MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);
     t0=MPI_Wtime();
+    LAT_START(lt);
     for(i=0;i<reps;i++){
       MPI_Send(sbuffer,len,MPI_BYTE,to,MSG_TAG(i),MPI_COMM_WORLD);
       MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,MSG_TAG(i),
 	       MPI_COMM_WORLD,&status);
+      LAT_LAP(lt);
     }
     t1 = MPI_Wtime();
     elapsed_time = t1-t0;
@@ -435,6 +472,7 @@ double exchange_async( int reps, int len, PairData ctx)
   MPI_Request  msg_id;
   char           *sbuffer,*rbuffer;
   double   t0, t1;
+  LatTick  lt = 0;
   MPI_Status status;
 
   sbuffer = (char *)malloc(len);
@@ -450,11 +488,13 @@ double exchange_async( int reps, int len, PairData ctx)
     if (source_type == SpecifiedSource) recv_from = to;
     MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);  	
     t0=MPI_Wtime();
+    LAT_START(lt);
     for(i=0;i<reps;i++){
       MPI_Irecv(rbuffer,len,MPI_BYTE,recv_from,MSG_TAG(i),
 		MPI_COMM_WORLD,&msg_id);
       MPI_Send(sbuffer,len,MPI_BYTE,to,MSG_TAG(i),MPI_COMM_WORLD);
       MPI_Wait(&(msg_id),&status);
+      LAT_LAP(lt);
     }
     t1=MPI_Wtime();
     elapsed_time = t1-t0;
@@ -489,6 +529,7 @@ double exchange_ssend( int reps, int len, PairData ctx)
   MPI_Request  msg_id;
   char           *sbuffer,*rbuffer;
   double   t0, t1;
+  LatTick  lt = 0;
   MPI_Status status;
 
   sbuffer = (char *)malloc(len);
@@ -504,11 +545,13 @@ double exchange_ssend( int reps, int len, PairData ctx)
     if (source_type == SpecifiedSource) recv_from = to;
     MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);  	
     t0=MPI_Wtime();
+    LAT_START(lt);
     for(i=0;i<reps;i++){
       MPI_Irecv(rbuffer,len,MPI_BYTE,recv_from,MSG_TAG(i),
 		MPI_COMM_WORLD,&msg_id);
       MPI_Ssend(sbuffer,len,MPI_BYTE,to,MSG_TAG(i),MPI_COMM_WORLD);
       MPI_Wait(&(msg_id),&status);
+      LAT_LAP(lt);
     }
     t1=MPI_Wtime();
     elapsed_time = t1-t0;
@@ -546,6 +589,7 @@ double exchange_forcetype( int reps, int len, PairData ctx)
   MPI_Status   status;
   char           *sbuffer,*rbuffer;
   double   t0, t1;
+  LatTick  lt = 0;
 
   sbuffer = (char *)malloc(len);
   rbuffer = (char *)malloc(len);
@@ -560,12 +604,14 @@ double exchange_forcetype( int reps, int len, PairData ctx)
     if (source_type == SpecifiedSource) recv_from = to;
     MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,3,MPI_COMM_WORLD,&status);
     t0=MPI_Wtime();
+    LAT_START(lt);
     for(i=0;i<reps;i++){
       MPI_Irecv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&(msg_id));
       MPI_Send(NULL,0,MPI_BYTE,to,2,MPI_COMM_WORLD);
       MPI_Recv(dmy,0,MPI_BYTE,recv_from,2,MPI_COMM_WORLD,&status);
       MPI_Rsend(sbuffer,len,MPI_BYTE,to,0,MPI_COMM_WORLD);
       MPI_Wait(&(msg_id),&status);
+      LAT_LAP(lt);
     }
     t1=MPI_Wtime();
     elapsed_time = t1-t0;
@@ -601,6 +647,7 @@ double round_trip_sync( int reps, int len, PairData ctx)
   char *rbuffer,*sbuffer;
   MPI_Status status;
   double t0, t1;
+  LatTick lt = 0;
 
   sbuffer = (char *)malloc(len);
   rbuffer = (char *)malloc(len);
@@ -615,10 +662,12 @@ double round_trip_sync( int reps, int len, PairData ctx)
     if (source_type == SpecifiedSource) recv_from = to;
     MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);
     t0=MPI_Wtime();
+    LAT_START(lt);
     for(i=0;i<reps;i++){
       MPI_Send(sbuffer,len,MPI_BYTE,to,MSG_TAG(i),MPI_COMM_WORLD);
       MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,MSG_TAG(i),
 	       MPI_COMM_WORLD,&status);
+      LAT_LAP(lt);
     }
     t1=MPI_Wtime();
     elapsed_time = t1 -t0;
@@ -652,6 +701,7 @@ double round_trip_ssend( int reps, int len, PairData ctx)
   char *rbuffer,*sbuffer;
   MPI_Status status;
   double t0, t1;
+  LatTick lt = 0;
 
   sbuffer = (char *)malloc(len);
   rbuffer = (char *)malloc(len);
@@ -666,10 +716,12 @@ double round_trip_ssend( int reps, int len, PairData ctx)
     if (source_type == SpecifiedSource) recv_from = to;
     MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);
     t0=MPI_Wtime();
+    LAT_START(lt);
     for(i=0;i<reps;i++){
       MPI_Ssend(sbuffer,len,MPI_BYTE,to,MSG_TAG(i),MPI_COMM_WORLD);
       MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,MSG_TAG(i),
 	       MPI_COMM_WORLD,&status);
+      LAT_LAP(lt);
     }
     t1=MPI_Wtime();
     elapsed_time = t1 -t0;
@@ -702,6 +754,7 @@ double round_trip_force( int reps, int len, PairData ctx)
   int  recv_from;
   char *rbuffer,*sbuffer;
   double t0, t1;
+  LatTick lt = 0;
   MPI_Request rid;
   MPI_Status  status;
 
@@ -718,11 +771,13 @@ double round_trip_force( int reps, int len, PairData ctx)
     if (source_type == SpecifiedSource) recv_from = to;
     MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);
     t0=MPI_Wtime();
+    LAT_START(lt);
     for(i=0;i<reps;i++){
       MPI_Irecv(rbuffer,len,MPI_BYTE,recv_from,MSG_TAG(i),
 		MPI_COMM_WORLD,&(rid));
       MPI_Rsend(sbuffer,len,MPI_BYTE,to,MSG_TAG(i),MPI_COMM_WORLD);
       MPI_Wait(&(rid),&status);
+      LAT_LAP(lt);
     }
     t1=MPI_Wtime();
     elapsed_time = t1 -t0;
@@ -761,6 +816,7 @@ double round_trip_async( int reps, int len, PairData ctx)
   char *rbuffer,*sbuffer;
   MPI_Status status;
   double t0, t1;
+  LatTick lt = 0;
   MPI_Request rid;
 
   sbuffer = (char *)malloc(len);
@@ -776,11 +832,13 @@ double round_trip_async( int reps, int len, PairData ctx)
     if (source_type == SpecifiedSource) recv_from = to;
     MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);
     t0=MPI_Wtime();
+    LAT_START(lt);
     for(i=0;i<reps;i++){
       MPI_Irecv(rbuffer,len,MPI_BYTE,recv_from,MSG_TAG(i),
 		MPI_COMM_WORLD,&(rid));
       MPI_Send(sbuffer,len,MPI_BYTE,to,MSG_TAG(i),MPI_COMM_WORLD);
       MPI_Wait(&(rid),&status);
+      LAT_LAP(lt);
     }
     t1=MPI_Wtime();
     elapsed_time = t1 -t0;
@@ -808,6 +866,124 @@ double round_trip_async( int reps, int len, PairData ctx)
   return(elapsed_time);
 }
 
+/*
+   Windowed stream: the master sends reps messages as nonblocking sends,
+   Window at a time, and the slave acknowledges every window with an empty
+   message.  The time is that of all messages, so time/reps is the inverse
+   of the message rate.  With -threads n, n threads of the master and of
+   the slave run a stream of reps messages each, on their own
+   communicators, and the time is divided by n: time/reps is the time per
+   message of all threads together.
+ */
+typedef struct {
+  int      reps, len;
+  PairData ctx;
+  MPI_Comm comm;
+} StreamArgs;
+
+static void stream_window( int reps, int len, PairData ctx, MPI_Comm comm )
+{
+  int  i, j, n, to = ctx->destination, from = ctx->source;
+  char *rbuffer,*sbuffer;
+  MPI_Status status;
+  MPI_Request *rid;
+
+  sbuffer = (char *)malloc(len);
+  /* every posted receive needs its own buffer */
+  rbuffer = (char *)malloc(len * Window + 1);
+  rid     = (MPI_Request *)malloc(Window * sizeof(MPI_Request));
+  memset( sbuffer, 0, len );
+  memset( rbuffer, 0, len * Window + 1 );
+
+  if(ctx->is_master){
+    for(i=0;i<reps;i+=n){
+      n = reps - i < Window ? reps - i : Window;
+      for(j=0;j<n;j++)
+	MPI_Isend(sbuffer,len,MPI_BYTE,to,MSG_TAG(i+j),comm,&rid[j]);
+      MPI_Waitall(n,rid,MPI_STATUSES_IGNORE);
+      MPI_Recv(rbuffer,0,MPI_BYTE,to,0,comm,&status);
+    }
+  }
+
+  if(ctx->is_slave){
+    for(i=0;i<reps;i+=n){
+      n = reps - i < Window ? reps - i : Window;
+      for(j=0;j<n;j++)
+	MPI_Irecv(rbuffer + j * len,len,MPI_BYTE,from,MSG_TAG(i+j),
+		  comm,&rid[j]);
+      MPI_Waitall(n,rid,MPI_STATUSES_IGNORE);
+      MPI_Send(sbuffer,0,MPI_BYTE,from,0,comm);
+    }
+  }
+
+  free(sbuffer);
+  free(rbuffer);
+  free(rid);
+}
+
+#ifdef HAVE_MPI_INIT_THREAD
+static void *stream_thread( void *arg )
+{
+  StreamArgs *a = (StreamArgs *)arg;
+
+  stream_window( a->reps, a->len, a->ctx, a->comm );
+  return 0;
+}
+#endif
+
+double stream_async( int reps, int len, PairData ctx)
+{
+  double elapsed_time;
+  int  to = ctx->destination, from = ctx->source;
+  char buf[1];
+  MPI_Status status;
+  double t0, t1;
+
+  SetupTest( from );
+  ConfirmTest( reps, len, ctx );
+  elapsed_time = 0;
+  if (!ctx->is_master && !ctx->is_slave) {
+    FinishTest();
+    return elapsed_time;
+  }
+  if(ctx->is_master)
+    MPI_Recv(buf,0,MPI_BYTE,to,0,MPI_COMM_WORLD,&status);
+  else
+    MPI_Send(buf,0,MPI_BYTE,from,0,MPI_COMM_WORLD);
+  t0=MPI_Wtime();
+#ifdef HAVE_MPI_INIT_THREAD
+  if (Threads > 1) {
+    pthread_t  thread[MAX_STREAM_THREADS];
+    StreamArgs args[MAX_STREAM_THREADS];
+    int        t;
+
+    for (t = 0; t < Threads; t++) {
+      args[t].reps = reps;
+      args[t].len  = len;
+      args[t].ctx  = ctx;
+      args[t].comm = ThreadComm[t];
+      pthread_create( &thread[t], 0, stream_thread, &args[t] );
+    }
+    for (t = 0; t < Threads; t++)
+      pthread_join( thread[t], 0 );
+  }
+  else
+#endif
+    stream_window( reps, len, ctx, MPI_COMM_WORLD );
+  t1=MPI_Wtime();
+  if(ctx->is_master)
+    elapsed_time = (t1 - t0) / Threads;
+
+  FinishTest();
+  return(elapsed_time);
+}
+
+/* Messages in flight with -window, or 0 for the roundtrip tests */
+int PairWindow( void )
+{
+    return Window;
+}
+
 /* 
    Persistant communication (only in MPI) 
  */
@@ -818,6 +994,7 @@ double round_trip_persis( int reps, int len, PairData ctx)
   int  recv_from;
   char *rbuffer,*sbuffer;
   double t0, t1;
+  LatTick lt = 0;
   MPI_Request sid, rid, rq[2];
   MPI_Status status, statuses[2];
 
@@ -839,9 +1016,11 @@ double round_trip_persis( int reps, int len, PairData ctx)
     rq[1] = sid;
     MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);
     t0=MPI_Wtime();
+    LAT_START(lt);
     for(i=0;i<reps;i++){
       MPI_Startall( 2, rq );
       MPI_Waitall( 2, rq, statuses );
+      LAT_LAP(lt);
     }
     t1=MPI_Wtime();
     elapsed_time = t1 -t0;
@@ -891,6 +1070,7 @@ double round_trip_vector(int reps, int len, PairData ctx)
   unsigned datalen;
   double *rbuffer,*sbuffer;
   double t0, t1;
+  LatTick lt = 0;
   MPI_Datatype vec, types[2];
   int          blens[2];
   MPI_Aint     displs[2];
@@ -925,9 +1105,11 @@ double round_trip_vector(int reps, int len, PairData ctx)
     if (source_type == SpecifiedSource) recv_from = to;
     MPI_Recv( rbuffer, len, vec, recv_from, 0, comm, &status );
     t0=MPI_Wtime();
+    LAT_START(lt);
     for(i=0;i<reps;i++){
       MPI_Send( sbuffer, len, vec, to, MSG_TAG(i), comm );
       MPI_Recv( rbuffer, len, vec, recv_from, MSG_TAG(i), comm, &status );
+      LAT_LAP(lt);
       }
     t1=MPI_Wtime();
     elapsed_time = t1 - t0;
@@ -958,6 +1140,7 @@ double round_trip_vectortype( int reps, int len, PairData ctx)
   unsigned datalen;
   double *rbuffer,*sbuffer;
   double t0, t1;
+  LatTick lt = 0;
   MPI_Datatype vec;
   MPI_Status   status;
   MPI_Comm     comm;
@@ -988,9 +1171,11 @@ double round_trip_vectortype( int reps, int len, PairData ctx)
     if (source_type == SpecifiedSource) recv_from = to;
     MPI_Recv( rbuffer, 1, vec, recv_from, 0, comm, &status );
     t0=MPI_Wtime();
+    LAT_START(lt);
     for(i=0;i<reps;i++){
       MPI_Send( sbuffer, 1, vec, to, MSG_TAG(i), comm );
       MPI_Recv( rbuffer, 1, vec, recv_from, MSG_TAG(i), comm, &status );
+      LAT_LAP(lt);
       }
     t1=MPI_Wtime();
     elapsed_time = t1 -t0;
@@ -1027,6 +1212,7 @@ double round_trip_nc_sync( int reps, int len, PairData ctx)
     char *rbuffer,*sbuffer, *rp, *sp, *rlast, *slast;
     MPI_Status status;
     double t0, t1;
+    LatTick lt = 0;
 
     sbuffer = (char *)malloc((unsigned)(2 * CacheSize ));
     slast   = sbuffer + 2 * CacheSize - len;
@@ -1049,6 +1235,7 @@ double round_trip_nc_sync( int reps, int len, PairData ctx)
 	if (source_type == SpecifiedSource) recv_from = to;
 	MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);
 	t0=MPI_Wtime();
+	LAT_START(lt);
 	for(i=0;i<reps;i++){
 	    MPI_Send(sp,len,MPI_BYTE,to,MSG_TAG(i),MPI_COMM_WORLD);
 	    MPI_Recv(rp,len,MPI_BYTE,recv_from,MSG_TAG(i),
@@ -1057,6 +1244,7 @@ double round_trip_nc_sync( int reps, int len, PairData ctx)
 	    rp += len;
 	    if (sp > slast) sp = sbuffer;
 	    if (rp > rlast) rp = rbuffer;
+	    LAT_LAP(lt);
 	}
 	t1=MPI_Wtime();
 	elapsed_time = t1 -t0;
@@ -1093,6 +1281,7 @@ double round_trip_nc_force( int reps, int len, PairData ctx)
     int  recv_from;
     char *rbuffer,*sbuffer, *rp, *sp, *rlast, *slast;
     double t0, t1;
+    LatTick lt = 0;
     MPI_Request rid;
     MPI_Status  status;
 
@@ -1117,6 +1306,7 @@ double round_trip_nc_force( int reps, int len, PairData ctx)
 	if (source_type == SpecifiedSource) recv_from = to;
 	MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);
 	t0=MPI_Wtime();
+	LAT_START(lt);
 	for(i=0;i<reps;i++){
 	    MPI_Irecv(rp,len,MPI_BYTE,recv_from,MSG_TAG(i),
 		      MPI_COMM_WORLD,&(rid));
@@ -1126,6 +1316,7 @@ double round_trip_nc_force( int reps, int len, PairData ctx)
 	    rp += len;
 	    if (sp > slast) sp = sbuffer;
 	    if (rp > rlast) rp = rbuffer;
+	    LAT_LAP(lt);
 	}
 	t1=MPI_Wtime();
 	elapsed_time = t1 -t0;
@@ -1167,6 +1358,7 @@ double round_trip_nc_async( int reps, int len, PairData ctx)
     int  recv_from;
     char *rbuffer,*sbuffer, *rp, *sp, *rlast, *slast;
     double t0, t1;
+    LatTick lt = 0;
     MPI_Request rid;
     MPI_Status  status;
 
@@ -1191,6 +1383,7 @@ double round_trip_nc_async( int reps, int len, PairData ctx)
 	if (source_type == SpecifiedSource) recv_from = to;
 	MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);
 	t0=MPI_Wtime();
+	LAT_START(lt);
 	for(i=0;i<reps;i++){
 	    MPI_Irecv(rp,len,MPI_BYTE,recv_from,MSG_TAG(i),
 		      MPI_COMM_WORLD,&(rid));
@@ -1200,6 +1393,7 @@ double round_trip_nc_async( int reps, int len, PairData ctx)
 	    rp += len;
 	    if (sp > slast) sp = sbuffer;
 	    if (rp > rlast) rp = rbuffer;
+	    LAT_LAP(lt);
 	}
 	t1=MPI_Wtime();
 	elapsed_time = t1 -t0;
@@ -1239,6 +1433,7 @@ double exchange_put( int reps, int len, PairData ctx)
     int  recv_from;
     char *sbuffer,*rbuffer;
     double t0, t1;
+    LatTick lt = 0;
     MPI_Status status;
     MPI_Win    win;
     int        alloc_len;
@@ -1272,10 +1467,12 @@ double exchange_put( int reps, int len, PairData ctx)
 	if (source_type == SpecifiedSource) recv_from = to;
 	MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);
 	t0=MPI_Wtime();
+	LAT_START(lt);
 	for(i=0;i<reps;i++){
 	    MPI_Put( sbuffer, len, MPI_BYTE, to, 
 		     0, len, MPI_BYTE, win );
 	    MPI_Win_fence( 0, win );
+	    LAT_LAP(lt);
 	}
 	t1 = MPI_Wtime();
 	elapsed_time = t1-t0;
@@ -1314,6 +1511,7 @@ double round_trip_put( int reps, int len, PairData ctx)
     int  recv_from;
     char *rbuffer,*sbuffer;
     double t0, t1;
+    LatTick lt = 0;
     MPI_Win win;
     MPI_Status status;
     int alloc_len;
@@ -1346,11 +1544,13 @@ double round_trip_put( int reps, int len, PairData ctx)
 	if (source_type == SpecifiedSource) recv_from = to;
 	MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);
 	t0=MPI_Wtime();
+	LAT_START(lt);
 	for(i=0;i<reps;i++){
 	    MPI_Put( sbuffer, len, MPI_BYTE, to, 
 		     0, len, MPI_BYTE, win );
 	    MPI_Win_fence( 0, win );
 	    MPI_Win_fence( 0, win );
+	    LAT_LAP(lt);
 	}
 	t1=MPI_Wtime();
 	elapsed_time = t1 -t0;
@@ -1393,6 +1593,7 @@ double round_trip_nc_put( int reps, int len, PairData ctx)
     int  recv_from;
     char *rbuffer,*sbuffer, *rp, *sp, *rlast, *slast;
     double t0, t1;
+    LatTick lt = 0;
     MPI_Win win;
     MPI_Status status;
 
@@ -1425,6 +1626,7 @@ double round_trip_nc_put( int reps, int len, PairData ctx)
 	if (source_type == SpecifiedSource) recv_from = to;
 	MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);
 	t0=MPI_Wtime();
+	LAT_START(lt);
 	for(i=0;i<reps;i++){
 	    MPI_Put( sp, len, MPI_BYTE, to, 
 		     (int)(rp - rbuffer), len, MPI_BYTE, win );
@@ -1434,6 +1636,7 @@ double round_trip_nc_put( int reps, int len, PairData ctx)
 	    rp += len;
 	    if (sp > slast) sp = sbuffer;
 	    if (rp > rlast) rp = rbuffer;
+	    LAT_LAP(lt);
 	}
 	t1=MPI_Wtime();
 	elapsed_time = t1 -t0;
@@ -1482,6 +1685,7 @@ double exchange_get( int reps, int len, PairData ctx)
     int  recv_from;
     char *sbuffer,*rbuffer;
     double t0, t1;
+    LatTick lt = 0;
     MPI_Status status;
     MPI_Win    win;
     int        alloc_len;
@@ -1514,10 +1718,12 @@ double exchange_get( int reps, int len, PairData ctx)
 	if (source_type == SpecifiedSource) recv_from = to;
 	MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);
 	t0=MPI_Wtime();
+	LAT_START(lt);
 	for(i=0;i<reps;i++){
 	    MPI_Get( rbuffer, len, MPI_BYTE, to, 
 		     0, len, MPI_BYTE, win );
 	    MPI_Win_fence( 0, win );
+	    LAT_LAP(lt);
 	}
 	t1 = MPI_Wtime();
 	elapsed_time = t1-t0;
@@ -1556,6 +1762,7 @@ double round_trip_get( int reps, int len, PairData ctx)
     int  recv_from;
     char *rbuffer,*sbuffer;
     double t0, t1;
+    LatTick lt = 0;
     MPI_Win win;
     MPI_Status status;
     int alloc_len;
@@ -1588,11 +1795,13 @@ double round_trip_get( int reps, int len, PairData ctx)
 	if (source_type == SpecifiedSource) recv_from = to;
 	MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);
 	t0=MPI_Wtime();
+	LAT_START(lt);
 	for(i=0;i<reps;i++){
 	    MPI_Get( rbuffer, len, MPI_BYTE, to, 
 		     0, len, MPI_BYTE, win );
 	    MPI_Win_fence( 0, win );
 	    MPI_Win_fence( 0, win );
+	    LAT_LAP(lt);
 	}
 	t1=MPI_Wtime();
 	elapsed_time = t1 -t0;
@@ -1635,6 +1844,7 @@ double round_trip_nc_get( int reps, int len, PairData ctx)
     int  recv_from;
     char *rbuffer,*sbuffer, *rp, *sp, *rlast, *slast;
     double t0, t1;
+    LatTick lt = 0;
     MPI_Win win;
     MPI_Status status;
 
@@ -1666,6 +1876,7 @@ double round_trip_nc_get( int reps, int len, PairData ctx)
 	if (source_type == SpecifiedSource) recv_from = to;
 	MPI_Recv(rbuffer,len,MPI_BYTE,recv_from,0,MPI_COMM_WORLD,&status);
 	t0=MPI_Wtime();
+	LAT_START(lt);
 	for(i=0;i<reps;i++){
 	    MPI_Get( rp, len, MPI_BYTE, to, 
 		     (int)(sp - sbuffer), len, MPI_BYTE, win );
@@ -1675,6 +1886,7 @@ double round_trip_nc_get( int reps, int len, PairData ctx)
 	    rp += len;
 	    if (sp > slast) sp = sbuffer;
 	    if (rp > rlast) rp = rbuffer;
+	    LAT_LAP(lt);
 	}
 	t1=MPI_Wtime();
 	elapsed_time = t1 -t0;
@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+#
+# Convert CH4 trace rings (dev/src/mpid/ch4/src/ch4_trace.h) to the
+# Chrome trace event format, viewable in chrome://tracing or Perfetto.
+#
+#   python3 traceToTimeline.py ch4trace.*.bin > timeline.json
+#
+# Every input file (one per process) becomes a process in the timeline
+# and every ring a thread. VCI lock acquire/release pairs become
+# duration slices, all other events instants. Timestamps are aligned
+# to the earliest record over all files.
+##
+
+import json
+import struct
+import sys
+
+FILE_HEADER = struct.Struct("=8sIIIId")
+RING_HEADER = struct.Struct("=IIQ")
+RECORD = struct.Struct("=QIIQQ")
+
+MAGIC = b"CH4TRACE"
+
+EVENTS = [
+    "send post",
+    "recv post",
+    "match",
+    "send complete",
+    "recv complete",
+    "vci lock acquire",
+    "vci lock release",
+    "handoff enqueue",
+    "handoff dequeue",
+]
+VCI_LOCK_ACQUIRE = 5
+VCI_LOCK_RELEASE = 6
+
+
+def readTrace(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    magic, version, nrings, pid, recordSize, nsPerTick = FILE_HEADER.unpack_from(data, 0)
+    if magic != MAGIC or version != 1 or recordSize != RECORD.size:
+        raise ValueError("%s: not a CH4 trace file (version 1)" % path)
+    offset = FILE_HEADER.size
+    rings = []
+    for _ in range(nrings):
+        tid, _reserved, nrecords = RING_HEADER.unpack_from(data, offset)
+        offset += RING_HEADER.size
+        records = [RECORD.unpack_from(data, offset + i * RECORD.size) for i in range(nrecords)]
+        offset += nrecords * RECORD.size
+        rings.append((tid, records))
+    return pid, nsPerTick, rings
+
+
+def eventName(event):
+    if event < len(EVENTS):
+        return EVENTS[event]
+    return "user %d" % (event - len(EVENTS))
+
+
+def convert(paths):
+    traces = [readTrace(path) for path in paths]
+    origin = min((rec[0] * nsPerTick for _, nsPerTick, rings in traces
+                  for _, records in rings for rec in records[:1]), default=0)
+    out = []
+    for pid, nsPerTick, rings in traces:
+        out.append({"name": "process_name", "ph": "M", "pid": pid,
+                    "args": {"name": "pid %d" % pid}})
+        for tid, records in rings:
+            for tsc, event, vci, arg0, arg1 in records:
+                ts = (tsc * nsPerTick - origin) / 1000.0
+                entry = {"pid": pid, "tid": tid, "ts": ts,
+                         "args": {"vci": vci, "arg0": arg0, "arg1": arg1}}
+                if event == VCI_LOCK_ACQUIRE:
+                    entry.update(name="vci %d" % vci, cat="lock", ph="B")
+                elif event == VCI_LOCK_RELEASE:
+                    entry.update(name="vci %d" % vci, cat="lock", ph="E")
+                else:
+                    entry.update(name=eventName(event), cat="ch4", ph="i", s="t")
+                out.append(entry)
+    return {"traceEvents": out, "displayTimeUnit": "ns"}
+
+
+def main(argv):
+    if len(argv) < 2:
+        sys.stderr.write("Usage: %s ch4trace.<pid>.bin... > timeline.json\n" % argv[0])
+        return 1
+    json.dump(convert(argv[1:]), sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))